@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdarg.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -10,6 +11,25 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <inttypes.h>
+#include <getopt.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <glob.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include <drm/drm.h>      // syncobj UAPI
 #include <drm/xe_drm.h>   // Xe UAPI (libdrm with xe support, or kernel uapi)
@@ -18,11 +38,377 @@
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 #endif
 
-#define BO_SIZE        4096
 #define BIND_ADDRESS   0x1000000ull   /* arbitrary GPU VA, page aligned */
 
-/* MI_BATCH_BUFFER_END: opcode 0x0A in bits 31:23 */
-#define MI_BATCH_BUFFER_END (0x0A << 23)
+/*
+ * Each BO starts with a data page the batch and the CPU share, followed by
+ * the batch itself, sized for the largest payload.
+ */
+#define DATA_SIZE       4096
+#define UFENCE_OFFSET   0      /* user fences: one qword per ring slot */
+#define SEM_OFFSET      512    /* dword the semaphore payload polls */
+#define SCRATCH_OFFSET  1024   /* MI_STORE_DWORD_IMM targets */
+#define SCRATCH_DWORDS  256
+#define TS_OFFSET       2048   /* --gpu-ts: start/end timestamp per ring slot */
+#define LOOP_OFFSET     2560   /* --gpu-loop: run flag per loop batch */
+#define DELAY_OFFSET    3072   /* delay payload: passes left */
+#define BATCH_OFFSET    DATA_SIZE
+
+#define SEM_READY       1u     /* SEM_OFFSET always holds this */
+
+/* MI commands: opcode in bits 31:23, dword length - 2 in the low bits */
+#define MI_NOOP                  0
+#define MI_BATCH_BUFFER_END      (0x0A << 23)
+#define MI_STORE_DWORD_IMM_GEN4  ((0x20 << 23) | 2)
+#define MI_SEMAPHORE_WAIT        ((0x1c << 23) | 2)
+#define   MI_SEMAPHORE_POLL        (1 << 15)
+#define   MI_SEMAPHORE_SAD_EQ_SDD  (4 << 12)
+#define MI_STORE_REGISTER_MEM    ((0x24 << 23) | 2)
+#define MI_ARB_CHECK             (0x05 << 23)
+#define MI_COND_BATCH_BUFFER_END ((0x36 << 23) | 2)
+#define   MI_DO_COMPARE            (1 << 21)
+#define MI_BATCH_BUFFER_START    ((0x31 << 23) | (1 << 8) | 1)   /* PPGTT */
+#define MI_LOAD_REGISTER_IMM(n)  ((0x22 << 23) | (2 * (n) - 1))
+#define   MI_LRI_CS_MMIO           (1 << 19)   /* offset by the engine base */
+#define MI_SRM_CS_MMIO           (1 << 19)
+#define MI_MATH(n)               ((0x1a << 23) | ((n) - 1))
+#define   MI_MATH_LOAD(dst, src)   ((0x080 << 20) | (dst) << 10 | (src))
+#define   MI_MATH_SUB              (0x101 << 20)
+#define   MI_MATH_STORE(dst, src)  ((0x180 << 20) | (dst) << 10 | (src))
+#define   MI_MATH_SRCA             0x20
+#define   MI_MATH_SRCB             0x21
+#define   MI_MATH_ACCU             0x31
+#define CS_GPR(n)                (0x2600 + 8 * (n))   /* with *_CS_MMIO */
+
+#define RING_TIMESTAMP(base)     ((base) + 0x358)   /* low 32 bits */
+#define GPU_CLOCK_RESYNC_NS      1000000000ull
+
+/*
+ * --gpu-loop hands the engine from one looping batch to the next this
+ * often, keeping every job far below the scheduler's job timeout (5 s by
+ * default).
+ */
+#define GPU_LOOP_PERIOD_NS       1000000000ull
+#define GPU_LOOP_SLOTS           2
+
+#define MAX_PAYLOAD_CMDS (1u << 20)
+#define DEFAULT_SWEEP_BATCHES 10000
+
+#define MAX_QUEUE_DEPTH 64
+#define MAX_SUBMITTERS  256
+#define MAX_GROUP       16     /* engines behind one exec queue */
+#define MAX_PROCS       256
+#define NUM_ENGINE_CLASSES (DRM_XE_ENGINE_CLASS_COMPUTE + 1)
+#define MAX_PMU_ENGINES 64
+#define DEFAULT_SPIN_NS 20000ull
+
+/*
+ * A submitter blocked on a fence checks this often whether its exec queue
+ * has been banned; a hang is reset by the scheduler's job timeout (5 s by
+ * default), the poll only bounds how late that is noticed.
+ */
+#define BAN_POLL_NS     100000000ull
+
+#define CONTROL_TIMEOUT_MS 100        /* most a control client may stall --epoll */
+#define CONTROL_CLIENT_MS  1000       /* to send a command after connecting */
+#define MAX_CONTROL_CLIENTS 8
+
+#define PACE_WINDOW_NS  50000000ull   /* pacing controller update period */
+#define PACE_SPIN_NS    50000ull      /* spin instead of sleeping below this */
+
+/*
+ * --warmup auto: a queue is steady once completion rate and mean latency
+ * each stay within STEADY_TOLERANCE of their mean over STEADY_WINDOWS
+ * consecutive STEADY_WINDOW_NS windows; measurement starts anyway after
+ * STEADY_MAX_NS.
+ */
+#define STEADY_WINDOW_NS 100000000ull
+#define STEADY_WINDOWS   5
+#define STEADY_TOLERANCE 0.05
+#define STEADY_MAX_NS    30000000000ull
+
+#define DEFAULT_IDLE_MS 50            /* --burst: idle gap between bursts */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+enum sync_mode {
+    SYNC_BINARY,      /* ring of binary syncobjs, reset before reuse */
+    SYNC_TIMELINE,    /* one timeline syncobj, point n+1 for batch n */
+    SYNC_UFENCE,      /* GPU writes n+1 into a BO qword, CPU spins on it */
+};
+
+enum payload_kind {
+    PAYLOAD_NOOP,     /* MI_NOOP padding */
+    PAYLOAD_STORE,    /* MI_STORE_DWORD_IMM into the scratch area */
+    PAYLOAD_SEM,      /* MI_SEMAPHORE_WAIT polls on an already-set dword */
+    PAYLOAD_DELAY,    /* a loop on the engine, N passes */
+};
+
+enum report_format {
+    FORMAT_TEXT,
+    FORMAT_CSV,
+    FORMAT_JSON,      /* one object per line */
+};
+
+static struct {
+    const char    *node;
+    uint32_t       depth;    /* batches allowed in flight */
+    enum sync_mode sync;
+    uint64_t       spin_ns;  /* SYNC_UFENCE: spin budget before blocking */
+    double         interval; /* seconds between reports, 0 = final only */
+    enum report_format format;
+    const char    *output;   /* report file, NULL = stdout */
+    const char    *engines;  /* NULL: first RENDER engine only */
+    uint32_t       queues_per_engine;
+    bool           pin;      /* pin submitter i to the i-th allowed CPU */
+    double         rate;     /* target submissions/s per queue, 0 = off */
+    double         duty;     /* target GPU duty cycle 0..1 per queue, 0 = off */
+    enum payload_kind payload;
+    uint32_t       payload_cmds;   /* commands before MI_BATCH_BUFFER_END */
+    uint32_t       sweep_max;      /* !0: double payload_cmds up to this */
+    uint64_t       sweep_batches;  /* batches per queue per sweep step */
+    bool           gpu_ts;   /* sample RING_TIMESTAMP around every batch */
+    bool           gpu_loop; /* self-looping batches instead of a submit loop */
+    bool           epoll;    /* one event loop thread for all queues */
+    const char    *control;  /* --epoll: unix control socket path */
+    int            priority; /* exec queue priority, -1 = default */
+    uint32_t       timeslice_us;       /* 0 = default */
+    int64_t        preempt_timeout_us; /* engine class sysfs, -1 = leave */
+    double         probe_rate;         /* !0: flood + probe queue per engine */
+    int            probe_priority;
+    bool           probe_priority_set;  /* else high only if permitted */
+    bool           lr;       /* long-running VM, user fence completion only */
+    uint32_t       width;    /* parallel exec queue over this many engines */
+    bool           virtual_engine;   /* one load-balanced queue per class */
+    uint32_t       procs;    /* DRM clients, one process each */
+    const char    *cpus;     /* submitter CPUs, NULL = the GPU's local CPUs */
+    int            fifo;     /* SCHED_FIFO priority, 0 = SCHED_OTHER */
+    bool           mlock;
+    bool           recover;  /* replace lost exec queues instead of dying */
+    double         warmup;   /* seconds discarded before measuring */
+    bool           warmup_auto;   /* ... or until steady state */
+    double         duration; /* measured seconds per queue, 0 = until stopped */
+    uint64_t       iterations;    /* measured batches per queue, 0 = unlimited */
+    bool           util;     /* sample engine utilisation (PMU, fdinfo) */
+    uint64_t       burst;    /* batches per burst, 0 = submit continuously */
+    uint64_t       idle_ns;  /* --burst: idle gap before each burst */
+} opt = {
+    .node     = "/dev/dri/renderD128",
+    .depth    = 1,
+    .sync     = SYNC_BINARY,
+    .spin_ns  = DEFAULT_SPIN_NS,
+    .interval = 1.0,
+    .format   = FORMAT_TEXT,
+    .queues_per_engine = 1,
+    .pin      = true,
+    .payload  = PAYLOAD_NOOP,
+    .sweep_batches = DEFAULT_SWEEP_BATCHES,
+    .priority = -1,
+    .preempt_timeout_us = -1,
+    .probe_priority = 2,       /* high */
+    .width    = 1,
+    .procs    = 1,
+    .recover  = true,
+    .idle_ns  = DEFAULT_IDLE_MS * 1000000ull,
+};
+
+static volatile sig_atomic_t stop_requested;
+static FILE *report_out;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t run_start;    /* CLOCK_MONOTONIC_RAW ns when submission began */
+static unsigned int proc_index;   /* --procs: this process */
+static pid_t child_pids[MAX_PROCS];   /* --procs parent: one per client */
+static volatile sig_atomic_t num_child_pids;
+
+/*
+ * HDR-style log-linear histogram of nanosecond values. Values below
+ * HIST_SUB get exact buckets; above that every power of two is split into
+ * HIST_SUB linear sub-buckets, bounding the relative error to 1/HIST_SUB.
+ */
+#define HIST_SUB_BITS  6
+#define HIST_SUB       (1u << HIST_SUB_BITS)
+#define HIST_BUCKETS   ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+/* Timestamps for one batch, CLOCK_MONOTONIC_RAW ns. */
+struct batch_times {
+    uint64_t submit;      /* before DRM_IOCTL_XE_EXEC */
+    uint64_t submitted;   /* after it returned */
+    uint64_t gpu_start;   /* --gpu-ts: engine timestamps converted to */
+    uint64_t gpu_end;     /* CPU time, 0 if not sampled */
+    bool     first;       /* --burst: first batch after an idle gap */
+};
+
+struct stats {
+    uint64_t         start_ns;
+    int64_t          cmds;     /* payload commands per batch, -1 if mixed */
+    uint64_t         busy_ns;  /* estimated GPU busy time, see fence_ring */
+    struct histogram exec;     /* exec ioctl duration */
+    struct histogram latency;  /* submit to observed completion */
+    struct histogram gpu;      /* --gpu-ts: batch start to end on the engine */
+    struct histogram queue;    /* --gpu-ts: submit to batch start */
+    struct histogram notify;   /* --gpu-ts: batch end to observed completion */
+    struct histogram recovery; /* last completion before a lost queue to
+                                  its replacement being ready */
+    uint64_t         lost;     /* batches in flight on lost queues */
+    struct histogram first;    /* --burst: latency of each burst's first
+                                  batch, submitted to an idle engine */
+    struct histogram rest;     /* --burst: latency of the batches after it */
+};
+
+/*
+ * Maps the low 32 bits of an engine's RING_TIMESTAMP onto
+ * CLOCK_MONOTONIC_RAW; resynchronised every GPU_CLOCK_RESYNC_NS, well
+ * inside the counter's wrap period.
+ */
+struct gpu_clock {
+    uint32_t ref_hz;           /* timestamp frequency of the GT */
+    uint32_t cycles;           /* engine timestamp ... */
+    uint64_t cpu_ns;           /* ... at this CPU time */
+    uint64_t next_ns;          /* when to resynchronise */
+};
+
+/*
+ * Closed-loop pacing for --rate / --duty. Every PACE_WINDOW_NS the
+ * measured completion rate (or estimated duty cycle) is compared with the
+ * target and a PI term scales the feed-forward issue rate.
+ */
+struct pacer {
+    double   target_rate;      /* submissions/s, 0 = pace on target_duty */
+    double   target_duty;      /* GPU duty cycle 0..1 */
+    double   rate;             /* current issue rate, submissions/s */
+    double   integral;         /* accumulated normalised error */
+    uint64_t next_ns;          /* when the next batch may be submitted */
+    uint64_t win_start;        /* current controller window */
+    uint64_t win_tail;         /* ring->tail at win_start */
+    uint64_t win_busy;         /* ring->busy_ns at win_start */
+};
+
+/*
+ * Out-fences for the batches in flight; head counts submitted batches,
+ * tail retired ones.
+ *
+ * SYNC_BINARY:   batch n signals syncobjs[n % depth], which is reset only
+ *                after its previous batch was waited for.
+ * SYNC_TIMELINE: batch n signals point n + 1 on syncobjs[0]; points only
+ *                grow, so nothing is ever reset.
+ * SYNC_UFENCE:   batch n writes n + 1 to ufence[n % depth] in the mapped
+ *                BO; the waiter spins on it before asking the kernel.
+ */
+struct fence_ring {
+    enum sync_mode mode;
+    uint32_t  depth;
+    uint32_t *syncobjs;
+    uint64_t  head;
+    uint64_t  tail;
+    struct batch_times *times;       /* per slot, for the batch in flight */
+
+    /*
+     * GPU busy estimate from completion times: a batch is taken to run
+     * from max(its submission, previous completion) to its completion.
+     */
+    uint64_t  last_done;
+    uint64_t  busy_ns;
+
+    volatile uint64_t *ufence;       /* CPU view of the fence qwords */
+    uint64_t  ufence_addr;           /* GPU VA of ufence[0] */
+    uint32_t  exec_queue_id;
+    bool      lost;                  /* a wait reported the queue reset */
+
+    volatile uint32_t *gpu_ts;       /* --gpu-ts: start/end pair per slot */
+    const struct gpu_clock *clock;
+};
+
+/*
+ * The engines behind one exec queue, in the layout exec queue creation
+ * takes: num_placements rows of width engines. A plain queue is 1x1; a
+ * parallel queue (--width) is one row of width engines submitted
+ * together; a virtual queue (--virtual) is one column of interchangeable
+ * engines the GuC balances across.
+ */
+struct engine_group {
+    uint16_t width;
+    uint16_t num_placements;
+    struct drm_xe_engine_class_instance inst[MAX_GROUP];
+};
+
+/*
+ * The VM all of a client's exec queues share. When it is banned, the
+ * first submitter to find out replaces it and bumps gen; the others see
+ * the new gen when their own queue is lost and rebind into it.
+ */
+struct shared_vm {
+    pthread_mutex_t lock;
+    uint32_t id;
+    uint32_t gen;
+};
+
+/* --warmup auto state: the last STEADY_WINDOWS windows of one queue. */
+struct steady {
+    uint64_t next_ns;            /* end of the current window */
+    uint64_t count, sum;         /* completions and latency sum before it */
+    double   rate[STEADY_WINDOWS];
+    double   lat[STEADY_WINDOWS];
+    uint32_t n;                  /* windows seen */
+};
+
+/*
+ * One exec queue and the thread feeding it. Every submitter owns a BO
+ * (data page + batch) bound at its own VA in the shared VM, so threads
+ * never touch each other's memory or fences.
+ */
+struct submitter {
+    int       fd;
+    struct shared_vm *vm;
+    uint32_t  vm_id;             /* the VM our BO is bound in ... */
+    uint32_t  vm_gen;            /* ... and its generation */
+    uint32_t  index;
+    char      name[24];          /* e.g. "rcs0", "ccs1.2", "gt1.vcs0", "ccs*" */
+    struct drm_xe_engine_class_instance inst;   /* first of the group */
+    struct engine_group group;
+    uint64_t  batch_addrs[MAX_GROUP];           /* width > 1: one per engine */
+    uint32_t  exec_queue_id;
+    uint32_t  bo_handle;
+    void     *map;
+    uint64_t  bo_size;
+    uint64_t  batch_stride;      /* --gpu-ts: one batch per ring slot */
+    uint32_t  mmio_base;         /* engine registers, for --gpu-ts */
+    struct gpu_clock clock;
+    int       efd;               /* --epoll: oldest batch in flight completed */
+    uint64_t  addr;              /* GPU VA of the BO */
+    uint32_t  placement;         /* memory regions for the BO */
+    int       cpu;               /* pinned CPU, -1 = not pinned */
+    pthread_t thread;
+
+    /* per queue, from the options; --probe gives its probe queues their own */
+    uint32_t  depth;
+    double    rate;
+    double    duty;
+    int       priority;          /* -1: default */
+    bool      priority_fallback; /* drop to normal if not permitted */
+
+    struct fence_ring ring;
+    struct pacer      pacer;
+    struct stats      total;     /* whole run */
+    struct stats      window;    /* since the last periodic report */
+
+    /* run length, see submitter_phase() */
+    bool      measuring;         /* warm-up over, stats count */
+    bool      done;              /* --epoll: ran its --duration/--iterations */
+    uint64_t  end_ns;            /* when its last batch was retired */
+    struct steady steady;
+};
 
 static void die(const char *msg)
 {
@@ -30,6 +416,14 @@ static void die(const char *msg)
     exit(EXIT_FAILURE);
 }
 
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 static int open_render_node(const char *path)
 {
     int fd = open(path, O_RDWR | O_CLOEXEC);
@@ -41,10 +435,10 @@ static int open_render_node(const char *path)
 }
 
 /*
- * Query engines and return first RENDER engine instance.
+ * Query engines; returns a malloc'd array of their class/instance pairs.
  */
-static struct drm_xe_engine_class_instance
-pick_render_engine(int fd)
+static struct drm_xe_engine_class_instance *
+query_engines(int fd, uint32_t *count)
 {
     struct drm_xe_device_query query = {
         .extensions = 0,
@@ -65,18 +459,193 @@ pick_render_engine(int fd)
     if (ioctl(fd, DRM_IOCTL_XE_DEVICE_QUERY, &query) < 0)
         die("DRM_IOCTL_XE_DEVICE_QUERY (ENGINES)");
 
-    for (uint32_t i = 0; i < engines->num_engines; i++) {
-        struct drm_xe_engine *e = &engines->engines[i];
-        if (e->instance.engine_class == DRM_XE_ENGINE_CLASS_RENDER) {
-            struct drm_xe_engine_class_instance inst = e->instance;
-            free(engines);
-            return inst;
+    struct drm_xe_engine_class_instance *list =
+        calloc(engines->num_engines, sizeof(*list));
+    if (!list)
+        die("calloc engine list");
+
+    for (uint32_t i = 0; i < engines->num_engines; i++)
+        list[i] = engines->engines[i].instance;
+
+    *count = engines->num_engines;
+    free(engines);
+    return list;
+}
+
+/* Short sysfs-style class names; NULL for classes we never submit to. */
+static const char *engine_class_name(uint16_t engine_class)
+{
+    switch (engine_class) {
+    case DRM_XE_ENGINE_CLASS_RENDER:        return "rcs";
+    case DRM_XE_ENGINE_CLASS_COPY:          return "bcs";
+    case DRM_XE_ENGINE_CLASS_VIDEO_DECODE:  return "vcs";
+    case DRM_XE_ENGINE_CLASS_VIDEO_ENHANCE: return "vecs";
+    case DRM_XE_ENGINE_CLASS_COMPUTE:       return "ccs";
+    default:                                return NULL;
+    }
+}
+
+/*
+ * Does engine e match one --engines token? Tokens are a class ("rcs",
+ * "render", "ccs", "compute", ...) meaning all its instances, or a class
+ * plus instance number ("ccs1").
+ */
+static bool engine_matches(const struct drm_xe_engine_class_instance *e,
+                           const char *tok)
+{
+    static const struct { const char *alias, *name; } aliases[] = {
+        { "render",        "rcs"  },
+        { "copy",          "bcs"  },
+        { "video",         "vcs"  },
+        { "video-enhance", "vecs" },
+        { "compute",       "ccs"  },
+    };
+    const char *name = engine_class_name(e->engine_class);
+
+    if (!name)
+        return false;
+    if (!strcmp(tok, "all"))
+        return true;
+
+    for (size_t i = 0; i < ARRAY_SIZE(aliases); i++)
+        if (!strcmp(tok, aliases[i].alias))
+            return !strcmp(name, aliases[i].name);
+
+    size_t len = strlen(name);
+    if (strncmp(tok, name, len))
+        return false;
+    if (tok[len] == '\0')
+        return true;
+
+    char *end;
+    unsigned long inst = strtoul(tok + len, &end, 10);
+    return *end == '\0' && end != tok + len && inst == e->engine_instance;
+}
+
+/*
+ * Engines to drive, in query order. Without --engines this is the first
+ * RENDER engine, as before.
+ */
+static struct drm_xe_engine_class_instance *
+select_engines(int fd, uint32_t *count)
+{
+    uint32_t n;
+    struct drm_xe_engine_class_instance *all = query_engines(fd, &n);
+    uint32_t out = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        bool match = false;
+
+        if (!opt.engines) {
+            match = all[i].engine_class == DRM_XE_ENGINE_CLASS_RENDER;
+        } else {
+            char *list = strdup(opt.engines), *save = NULL;
+            if (!list)
+                die("strdup engines");
+            for (char *tok = strtok_r(list, ",", &save); tok && !match;
+                 tok = strtok_r(NULL, ",", &save))
+                match = engine_matches(&all[i], tok);
+            free(list);
+        }
+
+        if (match) {
+            all[out++] = all[i];
+            if (!opt.engines)
+                break;
         }
     }
 
-    free(engines);
-    fprintf(stderr, "No RENDER engine found\n");
-    exit(EXIT_FAILURE);
+    if (!out) {
+        fprintf(stderr, "No engine matches %s\n",
+                opt.engines ? opt.engines : "RENDER");
+        exit(EXIT_FAILURE);
+    }
+
+    *count = out;
+    return all;
+}
+
+static bool same_class(const struct drm_xe_engine_class_instance *a,
+                       const struct drm_xe_engine_class_instance *b)
+{
+    return a->gt_id == b->gt_id && a->engine_class == b->engine_class;
+}
+
+/*
+ * Arrange the selected engines into exec queue groups: one per engine by
+ * default, one per class and GT with --virtual, or runs of --width
+ * consecutive instances of a class with --width. Engines left over from
+ * an incomplete run are skipped.
+ */
+static struct engine_group *
+group_engines(const struct drm_xe_engine_class_instance *engines, uint32_t n,
+              uint32_t *count)
+{
+    struct engine_group *groups = calloc(n, sizeof(*groups));
+    bool *used = calloc(n, sizeof(*used));
+    uint32_t out = 0;
+
+    if (!groups || !used)
+        die("calloc engine groups");
+
+    for (uint32_t i = 0; i < n; i++) {
+        struct engine_group *g = &groups[out];
+        uint32_t members = 0;
+
+        if (used[i])
+            continue;
+
+        if (!opt.virtual_engine && opt.width == 1) {
+            g->width = g->num_placements = 1;
+            g->inst[0] = engines[i];
+            out++;
+            continue;
+        }
+
+        /* all unused engines of this class, by instance */
+        for (uint16_t inst = 0; inst < 64 && members < MAX_GROUP; inst++)
+            for (uint32_t j = i; j < n; j++)
+                if (!used[j] && same_class(&engines[i], &engines[j]) &&
+                    engines[j].engine_instance == inst) {
+                    g->inst[members++] = engines[j];
+                    used[j] = true;
+                }
+
+        if (opt.virtual_engine) {
+            g->width = 1;
+            g->num_placements = members;
+            out++;
+            continue;
+        }
+
+        /* split into parallel queues of opt.width consecutive engines */
+        uint32_t runs = members / opt.width;
+
+        if (members % opt.width)
+            fprintf(stderr, "WARNING: %u %s engine(s) on gt%u do not fill a "
+                    "width %u queue, skipped\n", members % opt.width,
+                    engine_class_name(engines[i].engine_class),
+                    engines[i].gt_id, opt.width);
+        for (uint32_t r = 0; r < runs; r++) {
+            struct engine_group *pg = &groups[out++];
+
+            if (pg != g)
+                memcpy(pg->inst, &g->inst[r * opt.width],
+                       opt.width * sizeof(pg->inst[0]));
+            pg->width = opt.width;
+            pg->num_placements = 1;
+        }
+        if (!runs)
+            memset(g, 0, sizeof(*g));
+    }
+
+    free(used);
+    if (!out) {
+        fprintf(stderr, "No engine group of width %u\n", opt.width);
+        exit(EXIT_FAILURE);
+    }
+    *count = out;
+    return groups;
 }
 
 /*
@@ -126,6 +695,207 @@ static uint32_t pick_sysmem_placement(int fd, uint32_t *min_page_size_out)
     return placement;
 }
 
+/*
+ * Engine register base as seen by MI_STORE_REGISTER_MEM on that engine.
+ * Media GT engines use the same bases; the GSI offset only applies to CPU
+ * MMIO. Returns 0 for an engine not in the table.
+ */
+static uint32_t engine_mmio_base(const struct drm_xe_engine_class_instance *e)
+{
+    static const uint32_t vcs[] = {
+        0x1c0000, 0x1c4000, 0x1d0000, 0x1d4000,
+        0x1e0000, 0x1e4000, 0x1f0000, 0x1f4000,
+    };
+    static const uint32_t vecs[] = { 0x1c8000, 0x1d8000, 0x1e8000, 0x1f8000 };
+    static const uint32_t ccs[]  = { 0x1a000, 0x1c000, 0x1e000, 0x26000 };
+    uint16_t i = e->engine_instance;
+
+    switch (e->engine_class) {
+    case DRM_XE_ENGINE_CLASS_RENDER:
+        return i == 0 ? 0x2000 : 0;
+    case DRM_XE_ENGINE_CLASS_COPY:
+        /* bcs0, then the link copy engines bcs1..8 */
+        return i == 0 ? 0x22000 : i <= 8 ? 0x3e0000 + (i - 1) * 0x2000 : 0;
+    case DRM_XE_ENGINE_CLASS_VIDEO_DECODE:
+        return i < ARRAY_SIZE(vcs) ? vcs[i] : 0;
+    case DRM_XE_ENGINE_CLASS_VIDEO_ENHANCE:
+        return i < ARRAY_SIZE(vecs) ? vecs[i] : 0;
+    case DRM_XE_ENGINE_CLASS_COMPUTE:
+        return i < ARRAY_SIZE(ccs) ? ccs[i] : 0;
+    default:
+        return 0;
+    }
+}
+
+/* Sample the engine timestamp and CLOCK_MONOTONIC_RAW together. */
+static void gpu_clock_sync(int fd, const struct drm_xe_engine_class_instance *e,
+                           struct gpu_clock *clock)
+{
+    struct drm_xe_query_engine_cycles cycles = {
+        .eci     = *e,
+        .clockid = CLOCK_MONOTONIC_RAW,
+    };
+    struct drm_xe_device_query query = {
+        .extensions = 0,
+        .query      = DRM_XE_DEVICE_QUERY_ENGINE_CYCLES,
+        .size       = sizeof(cycles),
+        .data       = (uintptr_t)&cycles,
+    };
+
+    if (ioctl(fd, DRM_IOCTL_XE_DEVICE_QUERY, &query) < 0)
+        die("DRM_IOCTL_XE_DEVICE_QUERY (ENGINE_CYCLES)");
+
+    /* the engine was read somewhere within cpu_delta of cpu_timestamp */
+    clock->cycles  = (uint32_t)cycles.engine_cycles;
+    clock->cpu_ns  = cycles.cpu_timestamp + cycles.cpu_delta / 2;
+    clock->next_ns = clock->cpu_ns + GPU_CLOCK_RESYNC_NS;
+}
+
+/* Look up the timestamp frequency of e's GT, then take a first sample. */
+static void gpu_clock_init(int fd, const struct drm_xe_engine_class_instance *e,
+                           struct gpu_clock *clock)
+{
+    struct drm_xe_device_query query = {
+        .extensions = 0,
+        .query      = DRM_XE_DEVICE_QUERY_GT_LIST,
+        .size       = 0,
+        .data       = 0,
+    };
+
+    if (ioctl(fd, DRM_IOCTL_XE_DEVICE_QUERY, &query) < 0)
+        die("DRM_IOCTL_XE_DEVICE_QUERY (size GT_LIST)");
+
+    struct drm_xe_query_gt_list *gts = malloc(query.size);
+    if (!gts)
+        die("malloc gt_list");
+
+    query.data = (uintptr_t)gts;
+
+    if (ioctl(fd, DRM_IOCTL_XE_DEVICE_QUERY, &query) < 0)
+        die("DRM_IOCTL_XE_DEVICE_QUERY (GT_LIST)");
+
+    clock->ref_hz = 0;
+    for (uint32_t i = 0; i < gts->num_gt; i++)
+        if (gts->gt_list[i].gt_id == e->gt_id)
+            clock->ref_hz = gts->gt_list[i].reference_clock;
+    free(gts);
+
+    if (!clock->ref_hz) {
+        fprintf(stderr, "No timestamp frequency for gt%u\n", e->gt_id);
+        exit(EXIT_FAILURE);
+    }
+
+    gpu_clock_sync(fd, e, clock);
+}
+
+/* Engine timestamp to CLOCK_MONOTONIC_RAW ns, valid within +-2^31 ticks. */
+static uint64_t gpu_clock_ns(const struct gpu_clock *clock, uint32_t cycles)
+{
+    int64_t delta = (int32_t)(cycles - clock->cycles);
+
+    return clock->cpu_ns + delta * 1000000000ll / clock->ref_hz;
+}
+
+/*
+ * Find attr in the sysfs directory of e's engine class, e.g.
+ * /sys/dev/char/226:128/device/tile0/gt0/engines/rcs/preempt_timeout_us.
+ */
+static bool engine_sysfs_path(int fd, const struct drm_xe_engine_class_instance *e,
+                              const char *attr, char *path, size_t len)
+{
+    char pattern[PATH_MAX];
+    struct stat st;
+    glob_t g;
+    bool found;
+
+    if (fstat(fd, &st) < 0 || !engine_class_name(e->engine_class))
+        return false;
+
+    snprintf(pattern, sizeof(pattern),
+             "/sys/dev/char/%u:%u/device/tile*/gt%u/engines/%s/%s",
+             major(st.st_rdev), minor(st.st_rdev), e->gt_id,
+             engine_class_name(e->engine_class), attr);
+
+    found = !glob(pattern, 0, NULL, &g) && g.gl_pathc == 1;
+    if (found)
+        snprintf(path, len, "%s", g.gl_pathv[0]);
+    globfree(&g);
+    return found;
+}
+
+/* Engine class sysfs values changed for this run, restored at exit. */
+static struct {
+    char      path[PATH_MAX];
+    long long value;
+} sysfs_saved[64];
+static unsigned int num_sysfs_saved;
+
+static void sysfs_write_ll(const char *path, long long value)
+{
+    FILE *f = fopen(path, "w");
+
+    if (!f || fprintf(f, "%lld\n", value) < 0 || fclose(f) == EOF)
+        die(path);
+}
+
+/* atexit handler, so it must not die() itself */
+static void engine_sysfs_restore(void)
+{
+    for (unsigned int i = 0; i < num_sysfs_saved; i++) {
+        FILE *f = fopen(sysfs_saved[i].path, "w");
+
+        if (!f || fprintf(f, "%lld\n", sysfs_saved[i].value) < 0 ||
+            fclose(f) == EOF)
+            fprintf(stderr, "WARNING: could not restore %s to %lld\n",
+                    sysfs_saved[i].path, sysfs_saved[i].value);
+    }
+    num_sysfs_saved = 0;
+}
+
+/*
+ * Set attr of every selected engine's class to value, remembering the
+ * old value. Preemption timeout is not an exec queue property in the Xe
+ * UAPI; it only exists per engine class in sysfs.
+ */
+static void engine_sysfs_set(int fd, const struct drm_xe_engine_class_instance *engines,
+                             uint32_t count, const char *attr, long long value)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        char path[PATH_MAX];
+        unsigned int j;
+
+        if (!engine_sysfs_path(fd, &engines[i], attr, path, sizeof(path))) {
+            fprintf(stderr, "No sysfs %s for %s engines on gt%u\n", attr,
+                    engine_class_name(engines[i].engine_class),
+                    engines[i].gt_id);
+            exit(EXIT_FAILURE);
+        }
+
+        for (j = 0; j < num_sysfs_saved; j++)
+            if (!strcmp(sysfs_saved[j].path, path))
+                break;
+        if (j < num_sysfs_saved)
+            continue;
+        if (j == ARRAY_SIZE(sysfs_saved)) {
+            fprintf(stderr, "Too many sysfs %s files to set, %s left at "
+                    "its value\n", attr, path);
+            exit(EXIT_FAILURE);
+        }
+
+        FILE *f = fopen(path, "r");
+        if (!f || fscanf(f, "%lld", &sysfs_saved[j].value) != 1)
+            die(path);
+        fclose(f);
+
+        if (!num_sysfs_saved)
+            atexit(engine_sysfs_restore);
+        sysfs_write_ll(path, value);
+        snprintf(sysfs_saved[j].path, sizeof(sysfs_saved[j].path), "%s", path);
+        num_sysfs_saved++;
+        printf("%s: %lld -> %lld\n", path, sysfs_saved[j].value, value);
+    }
+}
+
 /* Create a binary syncobj and return its handle. */
 static uint32_t create_syncobj(int fd)
 {
@@ -153,12 +923,78 @@ static void reset_syncobj(int fd, uint32_t handle)
         die("DRM_IOCTL_SYNCOBJ_RESET");
 }
 
+static void destroy_syncobj(int fd, uint32_t handle)
+{
+    struct drm_syncobj_destroy destroy = { .handle = handle };
+
+    if (ioctl(fd, DRM_IOCTL_SYNCOBJ_DESTROY, &destroy) < 0)
+        die("DRM_IOCTL_SYNCOBJ_DESTROY");
+}
+
+/*
+ * Errors with which exec and fence waits report that the exec queue was
+ * reset, banned or killed (and so will never complete anything again).
+ */
+static bool queue_lost_errno(int err)
+{
+    return err == ECANCELED || err == EIO;
+}
+
+enum wait_status {
+    WAIT_DONE,
+    WAIT_TIMEOUT,
+    WAIT_LOST,        /* queue_lost_errno() */
+};
+
+/*
+ * Syncobj waits take an absolute CLOCK_MONOTONIC timeout; turn a relative
+ * timeout_ns (negative: forever) into one.
+ */
+static int64_t syncobj_deadline(int64_t timeout_ns)
+{
+    struct timespec ts;
+
+    if (timeout_ns < 0)
+        return INT64_MAX;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec + timeout_ns;
+}
+
+/*
+ * Wait for a timeline syncobj to reach point, for at most timeout_ns
+ * (negative: forever).
+ */
+static enum wait_status wait_syncobj_point(int fd, uint32_t handle, uint64_t point,
+                               int64_t timeout_ns)
+{
+    struct drm_syncobj_timeline_wait wait = {
+        .handles        = (uintptr_t)&handle,
+        .points         = (uintptr_t)&point,
+        .timeout_nsec   = syncobj_deadline(timeout_ns),
+        .count_handles  = 1,
+        .flags          = 0,   /* point was attached by the exec ioctl */
+        .first_signaled = 0,
+        .pad            = 0,
+        .deadline_nsec  = 0,
+    };
+
+    if (ioctl(fd, DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT, &wait) < 0) {
+        if (errno == ETIME)
+            return WAIT_TIMEOUT;
+        if (queue_lost_errno(errno))
+            return WAIT_LOST;
+        die("DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT");
+    }
+    return WAIT_DONE;
+}
+
 /* Wait for syncobj to signal (binary wait). */
-static void wait_syncobj(int fd, uint32_t handle)
+static enum wait_status wait_syncobj(int fd, uint32_t handle, int64_t timeout_ns)
 {
     struct drm_syncobj_wait wait = {
         .handles        = (uintptr_t)&handle,
-        .timeout_nsec   = INT64_MAX,   /* "infinite" timeout */
+        .timeout_nsec   = syncobj_deadline(timeout_ns),
         .count_handles  = 1,
         .flags          = 0,
         .first_signaled = 0,
@@ -166,180 +1002,3422 @@ static void wait_syncobj(int fd, uint32_t handle)
         .deadline_nsec  = 0,
     };
 
-    if (ioctl(fd, DRM_IOCTL_SYNCOBJ_WAIT, &wait) < 0)
+    if (ioctl(fd, DRM_IOCTL_SYNCOBJ_WAIT, &wait) < 0) {
+        if (errno == ETIME)
+            return WAIT_TIMEOUT;
+        if (queue_lost_errno(errno))
+            return WAIT_LOST;
         die("DRM_IOCTL_SYNCOBJ_WAIT");
+    }
+    return WAIT_DONE;
 }
 
-int main(int argc, char **argv)
+/*
+ * Block in the kernel until the user fence at addr equals value. Naming
+ * the exec queue makes a ban end the wait with EIO.
+ */
+static enum wait_status wait_user_fence(int fd, uint64_t addr, uint64_t value,
+                            uint32_t exec_queue_id, int64_t timeout_ns)
 {
-    const char *node = "/dev/dri/renderD128";
-    if (argc > 1)
-        node = argv[1];
-
-    int fd = open_render_node(node);
-    if (fd < 0)
-        return EXIT_FAILURE;
+    struct drm_xe_wait_user_fence wait = {
+        .extensions    = 0,
+        .addr          = addr,
+        .op            = DRM_XE_UFENCE_WAIT_OP_EQ,
+        .flags         = 0,
+        .value         = value,
+        .mask          = ~0ull,
+        .timeout       = timeout_ns,  /* relative; negative: no timeout */
+        .exec_queue_id = exec_queue_id,
+    };
 
-    printf("Opened %s\n", node);
+    if (ioctl(fd, DRM_IOCTL_XE_WAIT_USER_FENCE, &wait) < 0) {
+        if (errno == ETIME)
+            return WAIT_TIMEOUT;
+        if (queue_lost_errno(errno))
+            return WAIT_LOST;
+        die("DRM_IOCTL_XE_WAIT_USER_FENCE");
+    }
+    return WAIT_DONE;
+}
 
-    /* 1) Create VM */
-    struct drm_xe_vm_create vmc = {
-        .extensions = 0,
-        .flags      = 0,  /* simple VM */
-        .vm_id      = 0,
-    };
+/*
+ * Spin on the fence qword for up to spin_ns, then fall back to the
+ * kernel wait. Short batches complete inside the spin window and skip
+ * the scheduler wakeup entirely.
+ */
+static enum wait_status wait_user_fence_spin(int fd, volatile uint64_t *cpu,
+                                             uint64_t addr, uint64_t value,
+                                             uint32_t exec_queue_id,
+                                             uint64_t spin_ns,
+                                             int64_t timeout_ns)
+{
+    if (__atomic_load_n(cpu, __ATOMIC_ACQUIRE) == value)
+        return WAIT_DONE;
 
-    if (ioctl(fd, DRM_IOCTL_XE_VM_CREATE, &vmc) < 0)
-        die("DRM_IOCTL_XE_VM_CREATE");
+    if (timeout_ns >= 0 && spin_ns > (uint64_t)timeout_ns)
+        spin_ns = timeout_ns;
 
-    uint32_t vm_id = vmc.vm_id;
-    printf("VM created: id=%u\n", vm_id);
+    if (spin_ns) {
+        uint64_t deadline = now_ns() + spin_ns;
 
-    /* 2) Pick memory placement */
-    uint32_t min_page_size = 0;
-    uint32_t placement = pick_sysmem_placement(fd, &min_page_size);
+        do {
+            for (int i = 0; i < 64; i++) {
+                if (__atomic_load_n(cpu, __ATOMIC_ACQUIRE) == value)
+                    return WAIT_DONE;
+                cpu_relax();
+            }
+        } while (now_ns() < deadline);
+    }
 
-    if (!placement) {
-        fprintf(stderr, "WARNING: placement mask is 0, GEM_CREATE may fail\n");
+    if (timeout_ns >= 0) {
+        timeout_ns -= spin_ns;
+        if (timeout_ns <= 0)
+            return __atomic_load_n(cpu, __ATOMIC_ACQUIRE) == value ?
+                   WAIT_DONE : WAIT_TIMEOUT;
     }
+    return wait_user_fence(fd, addr, value, exec_queue_id, timeout_ns);
+}
 
-    /* 3) Create GEM buffer attached to this VM */
-    struct drm_xe_gem_create gcreate = {
-        .extensions  = 0,
-        .size        = BO_SIZE,
-        .placement   = placement,
-        .flags       = 0,
-        .vm_id       = vm_id,
-        .handle      = 0,
-        .cpu_caching = DRM_XE_GEM_CPU_CACHING_WB,
-    };
+/* ---------- statistics ---------- */
 
-    if (ioctl(fd, DRM_IOCTL_XE_GEM_CREATE, &gcreate) < 0)
-        die("DRM_IOCTL_XE_GEM_CREATE");
+static unsigned int hist_index(uint64_t v)
+{
+    if (v < HIST_SUB)
+        return v;
 
-    uint32_t bo_handle = gcreate.handle;
-    printf("GEM BO created: handle=%u, size=%" PRIu64 "\n",
-           bo_handle, (uint64_t)gcreate.size);
+    unsigned int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (unsigned int)((v >> shift) - HIST_SUB);
+}
 
-    /* 4) mmap the BO */
-    struct drm_xe_gem_mmap_offset mmo = {
-        .extensions = 0,
-        .handle     = bo_handle,
-        .flags      = 0,
-        .offset     = 0,
+/* Midpoint of the range of values that land in bucket idx. */
+static uint64_t hist_value(unsigned int idx)
+{
+    if (idx < HIST_SUB)
+        return idx;
+
+    unsigned int shift = idx / HIST_SUB - 1;
+    uint64_t base = (uint64_t)(idx % HIST_SUB + HIST_SUB) << shift;
+    return base + ((1ull << shift) >> 1);
+}
+
+static void hist_reset(struct histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static void hist_add(struct histogram *h, uint64_t v)
+{
+    h->buckets[hist_index(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+}
+
+static void hist_merge(struct histogram *dst, const struct histogram *src)
+{
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum   += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/* Value at percentile p (0..100), clamped to the exact min/max seen. */
+static uint64_t hist_percentile(const struct histogram *h, double p)
+{
+    if (!h->count)
+        return 0;
+
+    uint64_t rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+    uint64_t seen = 0;
+
+    if (rank < 1)
+        rank = 1;
+
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = hist_value(i);
+            return v < h->min ? h->min : v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+static void stats_reset(struct stats *st, uint64_t now)
+{
+    st->start_ns = now;
+    st->busy_ns = 0;
+    hist_reset(&st->exec);
+    hist_reset(&st->latency);
+    hist_reset(&st->gpu);
+    hist_reset(&st->queue);
+    hist_reset(&st->notify);
+    hist_reset(&st->recovery);
+    st->lost = 0;
+    hist_reset(&st->first);
+    hist_reset(&st->rest);
+}
+
+static void stats_record(struct stats *st, const struct batch_times *t,
+                         uint64_t done, uint64_t busy)
+{
+    st->busy_ns += busy;
+    hist_add(&st->exec, t->submitted - t->submit);
+    hist_add(&st->latency, done - t->submit);
+    if (opt.burst)
+        hist_add(t->first ? &st->first : &st->rest, done - t->submit);
+
+    if (t->gpu_end) {
+        /* clamp the small negative skews calibration error can produce */
+        hist_add(&st->gpu, t->gpu_end > t->gpu_start ?
+                           t->gpu_end - t->gpu_start : 0);
+        hist_add(&st->queue, t->gpu_start > t->submit ?
+                             t->gpu_start - t->submit : 0);
+        hist_add(&st->notify, done > t->gpu_end ? done - t->gpu_end : 0);
+    }
+}
+
+static void stats_merge(struct stats *dst, const struct stats *src)
+{
+    if (src->latency.count) {
+        if (!dst->latency.count)
+            dst->cmds = src->cmds;
+        else if (dst->cmds != src->cmds)
+            dst->cmds = -1;
+    }
+    dst->busy_ns += src->busy_ns;
+    hist_merge(&dst->exec, &src->exec);
+    hist_merge(&dst->latency, &src->latency);
+    hist_merge(&dst->gpu, &src->gpu);
+    hist_merge(&dst->queue, &src->queue);
+    hist_merge(&dst->notify, &src->notify);
+    hist_merge(&dst->recovery, &src->recovery);
+    dst->lost += src->lost;
+    hist_merge(&dst->first, &src->first);
+    hist_merge(&dst->rest, &src->rest);
+}
+
+/* With --format csv, write the header line to report_out once. */
+static void report_csv_header(void)
+{
+    static bool done;
+
+    if (opt.format != FORMAT_CSV || done)
+        return;
+
+    fprintf(report_out,
+            "scope,queue,elapsed_s,cmds,batches,subs_per_s,busy_pct,lat_mean_ns,"
+            "lat_p50_ns,lat_p99_ns,lat_p999_ns,lat_max_ns,"
+            "exec_p50_ns,exec_p99_ns,exec_max_ns,"
+            "gpu_p50_ns,gpu_p99_ns,queue_p50_ns,queue_p99_ns,"
+            "notify_p50_ns,notify_p99_ns,"
+            "recoveries,lost_batches,recovery_max_ns,"
+            "first_p50_ns,first_p99_ns,first_max_ns,rest_p50_ns,rest_p99_ns\n");
+    done = true;
+}
+
+/*
+ * One report line for st over [st->start_ns, now). scope is "interval"
+ * for periodic reports and "total" for the final one. The CSV header is
+ * only written to report_out.
+ */
+static void stats_report_to(FILE *out, const struct stats *st,
+                            const char *scope, const char *queue, uint64_t now)
+{
+    const struct histogram *lat = &st->latency, *ex = &st->exec;
+    const struct histogram *gpu = &st->gpu, *qd = &st->queue;
+    const struct histogram *nd = &st->notify, *rc = &st->recovery;
+    const struct histogram *fb = &st->first, *rb = &st->rest;
+    double window = (now - st->start_ns) / 1e9;
+    double elapsed = (now - run_start) / 1e9;
+    double rate = window > 0 ? lat->count / window : 0.0;
+    double mean = lat->count ? (double)lat->sum / lat->count : 0.0;
+    double busy = window > 0 ? st->busy_ns / (window * 1e9) * 100.0 : 0.0;
+
+    pthread_mutex_lock(&report_lock);
+
+    switch (opt.format) {
+    case FORMAT_CSV:
+        if (out == report_out)
+            report_csv_header();
+        fprintf(out,
+                "%s,%s,%.3f,%" PRId64 ",%" PRIu64 ",%.1f,%.1f,%.0f,%" PRIu64
+                ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                "\n",
+                scope, queue, elapsed, st->cmds, lat->count, rate, busy, mean,
+                hist_percentile(lat, 50), hist_percentile(lat, 99),
+                hist_percentile(lat, 99.9), lat->max,
+                hist_percentile(ex, 50), hist_percentile(ex, 99), ex->max,
+                hist_percentile(gpu, 50), hist_percentile(gpu, 99),
+                hist_percentile(qd, 50), hist_percentile(qd, 99),
+                hist_percentile(nd, 50), hist_percentile(nd, 99),
+                rc->count, st->lost, rc->max,
+                hist_percentile(fb, 50), hist_percentile(fb, 99), fb->max,
+                hist_percentile(rb, 50), hist_percentile(rb, 99));
+        break;
+    case FORMAT_JSON:
+        fprintf(out,
+                "{\"scope\":\"%s\",\"queue\":\"%s\",\"elapsed_s\":%.3f"
+                ",\"cmds\":%" PRId64 ",\"batches\":%" PRIu64
+                ",\"subs_per_s\":%.1f,\"busy_pct\":%.1f,\"lat_mean_ns\":%.0f"
+                ",\"lat_p50_ns\":%" PRIu64 ",\"lat_p99_ns\":%" PRIu64
+                ",\"lat_p999_ns\":%" PRIu64 ",\"lat_max_ns\":%" PRIu64
+                ",\"exec_p50_ns\":%" PRIu64 ",\"exec_p99_ns\":%" PRIu64
+                ",\"exec_max_ns\":%" PRIu64
+                ",\"gpu_p50_ns\":%" PRIu64 ",\"gpu_p99_ns\":%" PRIu64
+                ",\"queue_p50_ns\":%" PRIu64 ",\"queue_p99_ns\":%" PRIu64
+                ",\"notify_p50_ns\":%" PRIu64 ",\"notify_p99_ns\":%" PRIu64
+                ",\"recoveries\":%" PRIu64 ",\"lost_batches\":%" PRIu64
+                ",\"recovery_max_ns\":%" PRIu64
+                ",\"first_p50_ns\":%" PRIu64 ",\"first_p99_ns\":%" PRIu64
+                ",\"first_max_ns\":%" PRIu64
+                ",\"rest_p50_ns\":%" PRIu64 ",\"rest_p99_ns\":%" PRIu64
+                "}\n",
+                scope, queue, elapsed, st->cmds, lat->count, rate, busy, mean,
+                hist_percentile(lat, 50), hist_percentile(lat, 99),
+                hist_percentile(lat, 99.9), lat->max,
+                hist_percentile(ex, 50), hist_percentile(ex, 99), ex->max,
+                hist_percentile(gpu, 50), hist_percentile(gpu, 99),
+                hist_percentile(qd, 50), hist_percentile(qd, 99),
+                hist_percentile(nd, 50), hist_percentile(nd, 99),
+                rc->count, st->lost, rc->max,
+                hist_percentile(fb, 50), hist_percentile(fb, 99), fb->max,
+                hist_percentile(rb, 50), hist_percentile(rb, 99));
+        break;
+    default:
+        fprintf(out,
+                "[%8.1fs] %-8s %-10s %10.0f subs/s %5.1f%% busy  "
+                "lat p50 %8.1fus p99 %8.1fus p99.9 %8.1fus max %8.1fus  "
+                "exec p50 %6.1fus",
+                elapsed, scope, queue, rate, busy,
+                hist_percentile(lat, 50) / 1e3, hist_percentile(lat, 99) / 1e3,
+                hist_percentile(lat, 99.9) / 1e3, lat->max / 1e3,
+                hist_percentile(ex, 50) / 1e3);
+        if (st->cmds >= 0)
+            fprintf(out, "  cmds %" PRId64, st->cmds);
+        else
+            fprintf(out, "  cmds mixed");
+        if (opt.gpu_ts)
+            fprintf(out,
+                    "  gpu p50 %6.1fus queue p50 %6.1fus notify p50 %6.1fus"
+                    " p99 %6.1fus",
+                    hist_percentile(gpu, 50) / 1e3, hist_percentile(qd, 50) / 1e3,
+                    hist_percentile(nd, 50) / 1e3, hist_percentile(nd, 99) / 1e3);
+        if (rc->count)
+            fprintf(out, "  recovered %" PRIu64 "x (%" PRIu64 " lost, max %.1fms)",
+                    rc->count, st->lost, rc->max / 1e6);
+        if (opt.burst)
+            fprintf(out, "  first p50 %8.1fus p99 %8.1fus  rest p50 %8.1fus",
+                    hist_percentile(fb, 50) / 1e3, hist_percentile(fb, 99) / 1e3,
+                    hist_percentile(rb, 50) / 1e3);
+        fputc('\n', out);
+        break;
+    }
+    fflush(out);
+
+    pthread_mutex_unlock(&report_lock);
+}
+
+static void stats_report(const struct stats *st, const char *scope,
+                         const char *queue, uint64_t now)
+{
+    stats_report_to(report_out, st, scope, queue, now);
+}
+
+/*
+ * SIGINT/SIGTERM: stop submitting, drain and report. Another one a
+ * second or more later aborts a run whose drain is stuck; copies that
+ * arrive together (e.g. timeout(1) signals the child and its process
+ * group) do not. A --procs parent passes the request on as SIGUSR1,
+ * which never aborts.
+ */
+static void on_signal(int sig)
+{
+    static uint64_t first_ns;
+    uint64_t now = now_ns();
+
+    if (!first_ns) {
+        first_ns = now;
+    } else if (sig != SIGUSR1 && now - first_ns >= 1000000000ull) {
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+
+    stop_requested = 1;
+    for (sig_atomic_t i = 0; i < num_child_pids; i++)
+        kill(child_pids[i], SIGUSR1);
+}
+
+static void install_stop_handlers(void)
+{
+    struct sigaction sa = { .sa_handler = on_signal, .sa_flags = SA_RESTART };
+
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+static void fence_ring_init(int fd, struct fence_ring *ring,
+                            enum sync_mode mode, uint32_t depth,
+                            uint32_t exec_queue_id)
+{
+    uint32_t count = mode == SYNC_BINARY ? depth :
+                     mode == SYNC_TIMELINE ? 1 : 0;
+
+    ring->mode     = mode;
+    ring->depth    = depth;
+    ring->head     = 0;
+    ring->tail     = 0;
+    ring->last_done = 0;
+    ring->busy_ns  = 0;
+    ring->syncobjs = calloc(depth, sizeof(*ring->syncobjs));
+    ring->times    = calloc(depth, sizeof(*ring->times));
+    if (!ring->syncobjs || !ring->times)
+        die("calloc fence ring");
+
+    for (uint32_t i = 0; i < count; i++)
+        ring->syncobjs[i] = create_syncobj(fd);
+
+    ring->ufence        = NULL;
+    ring->ufence_addr   = 0;
+    ring->exec_queue_id = exec_queue_id;
+    ring->lost          = false;
+    ring->gpu_ts        = NULL;
+    ring->clock         = NULL;
+}
+
+/* SYNC_UFENCE: fence qwords live in a mapped, bound (zeroed) BO. */
+static void fence_ring_attach_ufence(struct fence_ring *ring, void *cpu,
+                                     uint64_t gpu_addr)
+{
+    ring->ufence      = cpu;
+    ring->ufence_addr = gpu_addr;
+}
+
+/* --gpu-ts: batch n stores its engine timestamps in gpu_ts[n % depth]. */
+static void fence_ring_attach_gpu_ts(struct fence_ring *ring, void *cpu,
+                                     const struct gpu_clock *clock)
+{
+    ring->gpu_ts = cpu;
+    ring->clock  = clock;
+}
+
+static bool fence_ring_full(const struct fence_ring *ring)
+{
+    return ring->head - ring->tail == ring->depth;
+}
+
+/* Fill in the out-fence for the next batch; caller submits it. */
+static void fence_ring_prepare(int fd, struct fence_ring *ring,
+                               struct drm_xe_sync *sync)
+{
+    if (ring->gpu_ts) {
+        uint32_t slot = ring->head % ring->depth;
+
+        ring->gpu_ts[2 * slot] = ring->gpu_ts[2 * slot + 1] = 0;
+    }
+
+    if (ring->mode == SYNC_TIMELINE) {
+        sync->type           = DRM_XE_SYNC_TYPE_TIMELINE_SYNCOBJ;
+        sync->handle         = ring->syncobjs[0];
+        sync->timeline_value = ring->head + 1;
+        return;
+    }
+
+    if (ring->mode == SYNC_UFENCE) {
+        sync->type           = DRM_XE_SYNC_TYPE_USER_FENCE;
+        sync->addr           = ring->ufence_addr +
+                               (ring->head % ring->depth) * sizeof(uint64_t);
+        sync->timeline_value = ring->head + 1;   /* value the GPU writes */
+        return;
+    }
+
+    sync->type           = DRM_XE_SYNC_TYPE_SYNCOBJ;
+    sync->handle         = ring->syncobjs[ring->head % ring->depth];
+    sync->timeline_value = 0;
+    reset_syncobj(fd, sync->handle);
+}
+
+/* Account a batch that was just submitted with the prepared fence. */
+static struct batch_times *fence_ring_push(struct fence_ring *ring,
+                                           uint64_t submit, uint64_t submitted)
+{
+    struct batch_times *t = &ring->times[ring->head % ring->depth];
+
+    t->submit    = submit;
+    t->submitted = submitted;
+    ring->head++;
+    return t;
+}
+
+static bool fence_ring_empty(const struct fence_ring *ring)
+{
+    return ring->head == ring->tail;
+}
+
+/*
+ * Wait up to timeout_ns (negative: forever) for the oldest batch in
+ * flight and record it. Returns false if it is still running, or if the
+ * queue was lost, which also sets ring->lost.
+ */
+static bool fence_ring_try_retire(int fd, struct fence_ring *ring,
+                                  struct stats *st, int64_t timeout_ns)
+{
+    uint32_t slot = ring->tail % ring->depth;
+    enum wait_status ws;
+
+    if (ring->mode == SYNC_TIMELINE)
+        ws = wait_syncobj_point(fd, ring->syncobjs[0], ring->tail + 1,
+                                timeout_ns);
+    else if (ring->mode == SYNC_UFENCE)
+        ws = wait_user_fence_spin(fd, &ring->ufence[slot],
+                                  ring->ufence_addr + slot * sizeof(uint64_t),
+                                  ring->tail + 1, ring->exec_queue_id,
+                                  opt.spin_ns, timeout_ns);
+    else
+        ws = wait_syncobj(fd, ring->syncobjs[slot], timeout_ns);
+
+    if (ws == WAIT_LOST)
+        ring->lost = true;
+    if (ws != WAIT_DONE)
+        return false;
+
+    struct batch_times *t = &ring->times[slot];
+    uint64_t done  = now_ns();
+
+    t->gpu_start = t->gpu_end = 0;
+    if (ring->gpu_ts) {
+        uint32_t start = ring->gpu_ts[2 * slot], end = ring->gpu_ts[2 * slot + 1];
+
+        if (start || end) {
+            t->gpu_start = gpu_clock_ns(ring->clock, start);
+            t->gpu_end   = gpu_clock_ns(ring->clock, end);
+        }
+    }
+
+    uint64_t start = t->submitted > ring->last_done ? t->submitted
+                                                    : ring->last_done;
+    uint64_t busy  = done > start ? done - start : 0;
+
+    ring->busy_ns  += busy;
+    ring->last_done = done;
+    stats_record(st, t, done, busy);
+    ring->tail++;
+    return true;
+}
+
+static void fence_ring_fini(int fd, struct fence_ring *ring)
+{
+    uint32_t count = ring->mode == SYNC_BINARY ? ring->depth :
+                     ring->mode == SYNC_TIMELINE ? 1 : 0;
+
+    for (uint32_t i = 0; i < count; i++)
+        destroy_syncobj(fd, ring->syncobjs[i]);
+    free(ring->syncobjs);
+    free(ring->times);
+}
+
+/*
+ * The queue behind ring was lost: forget the batches in flight and take
+ * fresh fences for its replacement. head keeps counting, so new timeline
+ * points and user fence values are above anything the old queue used.
+ */
+static void fence_ring_reset(int fd, struct fence_ring *ring,
+                             uint32_t exec_queue_id)
+{
+    uint32_t count = ring->mode == SYNC_BINARY ? ring->depth :
+                     ring->mode == SYNC_TIMELINE ? 1 : 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        destroy_syncobj(fd, ring->syncobjs[i]);
+        ring->syncobjs[i] = create_syncobj(fd);
+    }
+    ring->tail          = ring->head;
+    ring->exec_queue_id = exec_queue_id;
+    ring->lost          = false;
+}
+
+/*
+ * Wait for the oldest batch in flight to complete and record it. For
+ * the modes without recovery (see submitter_retire): a lost queue ends
+ * the run.
+ */
+static void fence_ring_retire(int fd, struct fence_ring *ring,
+                              struct stats *st)
+{
+    if (!fence_ring_try_retire(fd, ring, st, -1)) {
+        fprintf(stderr, "exec queue %u lost\n", ring->exec_queue_id);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Retire batches as they complete until deadline (CLOCK_MONOTONIC_RAW
+ * ns), so idle time before a paced submission is spent observing
+ * completions rather than leaving them to be noticed late.
+ */
+static void fence_ring_retire_until(int fd, struct fence_ring *ring,
+                                    struct stats *st, uint64_t deadline)
+{
+    while (!fence_ring_empty(ring) && !stop_requested) {
+        uint64_t now = now_ns();
+
+        if (now >= deadline ||
+            !fence_ring_try_retire(fd, ring, st, deadline - now))
+            return;
+    }
+}
+
+/*
+ * Have efd signalled once the oldest batch in flight completes. The
+ * registration is one-shot; an already signalled fence fires at once.
+ */
+static void fence_ring_arm_eventfd(int fd, const struct fence_ring *ring,
+                                   int efd)
+{
+    struct drm_syncobj_eventfd args = {
+        .handle = ring->mode == SYNC_TIMELINE ? ring->syncobjs[0] :
+                  ring->syncobjs[ring->tail % ring->depth],
+        .flags  = 0,
+        .point  = ring->mode == SYNC_TIMELINE ? ring->tail + 1 : 0,
+        .fd     = efd,
+    };
+
+    if (ioctl(fd, DRM_IOCTL_SYNCOBJ_EVENTFD, &args) < 0)
+        die("DRM_IOCTL_SYNCOBJ_EVENTFD");
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [render-node]\n"
+            "  -d, --depth N              batches in flight (1..%d, default 1)\n"
+            "  -t, --timeline             signal points on one timeline syncobj\n"
+            "                             instead of resetting binary syncobjs\n"
+            "  -u, --ufence               complete through user fences in the BO\n"
+            "  -s, --spin-ns N            with --ufence, spin N ns before blocking\n"
+            "                             in the kernel (default %llu, 0 = never)\n"
+            "  -i, --interval S           report every S seconds (default 1, 0 = off)\n"
+            "  -f, --format FMT           text, csv or json (JSON lines)\n"
+            "  -o, --output FILE          write reports to FILE instead of stdout\n"
+            "  -e, --engines LIST         all, or a comma list of classes (rcs/render,\n"
+            "                             bcs/copy, vcs/video, vecs/video-enhance,\n"
+            "                             ccs/compute) or instances (ccs1);\n"
+            "                             default: first rcs\n"
+            "  -q, --queues-per-engine N  exec queues (threads) per engine\n"
+            "      --no-pin               do not pin submitter threads to CPUs\n"
+            "      --cpus LIST            pin to these CPUs (e.g. 0-3,8), default: the\n"
+            "                             GPU's NUMA-local CPUs, else all allowed\n"
+            "      --fifo[=PRIO]          run submitters SCHED_FIFO (default prio 50)\n"
+            "      --mlock                lock all memory (mlockall) before submitting\n"
+            "      --warmup SEC|auto      discard the first SEC seconds, or (auto)\n"
+            "                             everything until rate and latency settle\n"
+            "      --duration SEC         measure each queue for SEC seconds, then stop\n"
+            "      --iterations N         measure each queue for N batches, then stop\n"
+            "      --util                 report engine class utilisation from the\n"
+            "                             Xe PMU and this client's fdinfo (with -f\n"
+            "                             csv as text on stderr)\n"
+            "      --no-recover           exit when an exec queue is reset or banned\n"
+            "                             instead of replacing it (--epoll and\n"
+            "                             --gpu-loop never recover)\n"
+            "      --burst N              submit in bursts of N batches, each after\n"
+            "                             the queue drained and idled --idle-ms;\n"
+            "                             reports first-batch vs later latency\n"
+            "                             (one queue only; compare at -d 1)\n"
+            "      --idle-ms MS           idle gap before each burst (default %d)\n"
+            "      --rate N               hold N submissions/s per queue\n"
+            "      --duty PCT             hold an estimated PCT%% GPU duty cycle\n"
+            "                             per queue (closed loop on completions)\n"
+            "      --payload KIND[:N]     N commands before MI_BATCH_BUFFER_END\n"
+            "                             (default noop:0): noop = MI_NOOP,\n"
+            "                             store = MI_STORE_DWORD_IMM, sem = polling\n"
+            "                             MI_SEMAPHORE_WAIT that is already satisfied,\n"
+            "                             delay = a loop of N >= 1 passes on the\n"
+            "                             engine (time per pass: see --gpu-ts)\n"
+            "      --sweep MAX            double N from --payload up to MAX\n"
+            "                             (starting at 1 if N is 0), one report per step\n"
+            "      --sweep-batches N      batches per queue per step (default %d)\n"
+            "      --gpu-ts               store the engine timestamp around each batch\n"
+            "                             and split latency into queue delay, GPU\n"
+            "                             execution and completion notification\n"
+            "      --gpu-loop             keep each engine busy with batches that loop\n"
+            "                             on the GPU until the CPU clears a flag;\n"
+            "                             one submission per second per queue\n"
+            "      --epoll                drive all queues from one thread, with\n"
+            "                             completions delivered by syncobj eventfds\n"
+            "      --control PATH         with --epoll, accept commands on a unix\n"
+            "                             socket, one per connection: stats, stop\n"
+            "      --priority P           exec queue priority: low, normal or high\n"
+            "                             (high needs CAP_SYS_NICE)\n"
+            "      --timeslice-us N       exec queue timeslice\n"
+            "      --preempt-timeout-us N set the preemption timeout of the selected\n"
+            "                             engine classes in sysfs for this run\n"
+            "      --probe RATE           per engine, a flood queue (the options\n"
+            "                             above) plus a depth 1 probe queue sending\n"
+            "                             RATE batches/s, to measure its latency\n"
+            "      --probe-priority P     priority of the probe queue (default high,\n"
+            "                             normal without CAP_SYS_NICE)\n"
+            "      --lr                   long-running VM: no dma-fence completion,\n"
+            "                             implies --ufence\n"
+            "      --width N              parallel exec queues over N consecutive\n"
+            "                             engines of a class, one batch each per exec\n"
+            "      --virtual              one exec queue per engine class spanning\n"
+            "                             all its selected engines (GuC balanced)\n"
+            "      --procs N              run N processes, each its own DRM client\n"
+            "                             (fd, VM, queues); report each and the sum\n"
+            "  -h, --help                 this text\n",
+            argv0, MAX_QUEUE_DEPTH, (unsigned long long)DEFAULT_SPIN_NS,
+            DEFAULT_IDLE_MS, DEFAULT_SWEEP_BATCHES);
+    exit(EXIT_FAILURE);
+}
+
+enum {
+    OPT_NO_PIN = 256,    /* long-only options */
+    OPT_RATE,
+    OPT_DUTY,
+    OPT_PAYLOAD,
+    OPT_SWEEP,
+    OPT_SWEEP_BATCHES,
+    OPT_GPU_TS,
+    OPT_GPU_LOOP,
+    OPT_EPOLL,
+    OPT_CONTROL,
+    OPT_PRIORITY,
+    OPT_TIMESLICE,
+    OPT_PREEMPT_TIMEOUT,
+    OPT_PROBE,
+    OPT_PROBE_PRIORITY,
+    OPT_LR,
+    OPT_WIDTH,
+    OPT_VIRTUAL,
+    OPT_PROCS,
+    OPT_CPUS,
+    OPT_FIFO,
+    OPT_MLOCK,
+    OPT_NO_RECOVER,
+    OPT_WARMUP,
+    OPT_DURATION,
+    OPT_ITERATIONS,
+    OPT_UTIL,
+    OPT_BURST,
+    OPT_IDLE_MS,
+};
+
+/* low, normal or high (the scheduler's priority levels), -1 if invalid */
+static int parse_priority(const char *arg)
+{
+    static const char *const names[] = { "low", "normal", "high" };
+
+    for (unsigned int i = 0; i < ARRAY_SIZE(names); i++)
+        if (!strcmp(arg, names[i]))
+            return i;
+    return -1;
+}
+
+/* Parse KIND[:N] for --payload. */
+static bool parse_payload(const char *arg)
+{
+    static const char *const names[] = {
+        [PAYLOAD_NOOP]  = "noop",
+        [PAYLOAD_STORE] = "store",
+        [PAYLOAD_SEM]   = "sem",
+        [PAYLOAD_DELAY] = "delay",
+    };
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(names); i++)
+        if (strlen(names[i]) == len && !strncmp(arg, names[i], len))
+            break;
+    if (i == ARRAY_SIZE(names))
+        return false;
+
+    opt.payload = i;
+    opt.payload_cmds = colon ? strtoul(colon + 1, NULL, 0) : 0;
+    return opt.payload_cmds <= MAX_PAYLOAD_CMDS;
+}
+
+static void parse_options(int argc, char **argv)
+{
+    static const struct option longopts[] = {
+        { "depth",    required_argument, NULL, 'd' },
+        { "timeline", no_argument,       NULL, 't' },
+        { "ufence",   no_argument,       NULL, 'u' },
+        { "spin-ns",  required_argument, NULL, 's' },
+        { "interval", required_argument, NULL, 'i' },
+        { "format",   required_argument, NULL, 'f' },
+        { "output",   required_argument, NULL, 'o' },
+        { "engines",  required_argument, NULL, 'e' },
+        { "queues-per-engine", required_argument, NULL, 'q' },
+        { "no-pin",   no_argument,       NULL, OPT_NO_PIN },
+        { "rate",     required_argument, NULL, OPT_RATE },
+        { "duty",     required_argument, NULL, OPT_DUTY },
+        { "payload",  required_argument, NULL, OPT_PAYLOAD },
+        { "sweep",    required_argument, NULL, OPT_SWEEP },
+        { "sweep-batches", required_argument, NULL, OPT_SWEEP_BATCHES },
+        { "gpu-ts",   no_argument,       NULL, OPT_GPU_TS },
+        { "gpu-loop", no_argument,       NULL, OPT_GPU_LOOP },
+        { "epoll",    no_argument,       NULL, OPT_EPOLL },
+        { "control",  required_argument, NULL, OPT_CONTROL },
+        { "priority", required_argument, NULL, OPT_PRIORITY },
+        { "timeslice-us", required_argument, NULL, OPT_TIMESLICE },
+        { "preempt-timeout-us", required_argument, NULL, OPT_PREEMPT_TIMEOUT },
+        { "probe",    required_argument, NULL, OPT_PROBE },
+        { "probe-priority", required_argument, NULL, OPT_PROBE_PRIORITY },
+        { "lr",       no_argument,       NULL, OPT_LR },
+        { "width",    required_argument, NULL, OPT_WIDTH },
+        { "virtual",  no_argument,       NULL, OPT_VIRTUAL },
+        { "procs",    required_argument, NULL, OPT_PROCS },
+        { "cpus",     required_argument, NULL, OPT_CPUS },
+        { "fifo",     optional_argument, NULL, OPT_FIFO },
+        { "mlock",    no_argument,       NULL, OPT_MLOCK },
+        { "no-recover", no_argument, NULL, OPT_NO_RECOVER },
+        { "warmup",   required_argument, NULL, OPT_WARMUP },
+        { "duration", required_argument, NULL, OPT_DURATION },
+        { "iterations", required_argument, NULL, OPT_ITERATIONS },
+        { "util",     no_argument,       NULL, OPT_UTIL },
+        { "burst",    required_argument, NULL, OPT_BURST },
+        { "idle-ms",  required_argument, NULL, OPT_IDLE_MS },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "d:tus:i:f:o:e:q:h", longopts, NULL)) != -1) {
+        switch (c) {
+        case 'd':
+            opt.depth = strtoul(optarg, NULL, 0);
+            if (opt.depth < 1 || opt.depth > MAX_QUEUE_DEPTH)
+                usage(argv[0]);
+            break;
+        case 't':
+            opt.sync = SYNC_TIMELINE;
+            break;
+        case 'u':
+            opt.sync = SYNC_UFENCE;
+            break;
+        case 's':
+            opt.spin_ns = strtoull(optarg, NULL, 0);
+            break;
+        case 'i':
+            opt.interval = strtod(optarg, NULL);
+            if (opt.interval < 0)
+                usage(argv[0]);
+            break;
+        case 'f':
+            if (!strcmp(optarg, "text"))
+                opt.format = FORMAT_TEXT;
+            else if (!strcmp(optarg, "csv"))
+                opt.format = FORMAT_CSV;
+            else if (!strcmp(optarg, "json"))
+                opt.format = FORMAT_JSON;
+            else
+                usage(argv[0]);
+            break;
+        case 'o':
+            opt.output = optarg;
+            break;
+        case 'e':
+            opt.engines = optarg;
+            break;
+        case 'q': {
+            unsigned long q = strtoul(optarg, NULL, 0);
+
+            /* bounded here so num_groups * q cannot wrap later */
+            if (q < 1 || q > MAX_SUBMITTERS)
+                usage(argv[0]);
+            opt.queues_per_engine = q;
+            break;
+        }
+        case OPT_NO_PIN:
+            opt.pin = false;
+            break;
+        case OPT_RATE:
+            opt.rate = strtod(optarg, NULL);
+            if (opt.rate <= 0)
+                usage(argv[0]);
+            break;
+        case OPT_DUTY:
+            opt.duty = strtod(optarg, NULL) / 100.0;
+            if (opt.duty <= 0 || opt.duty > 1)
+                usage(argv[0]);
+            break;
+        case OPT_PAYLOAD:
+            if (!parse_payload(optarg))
+                usage(argv[0]);
+            break;
+        case OPT_SWEEP:
+            opt.sweep_max = strtoul(optarg, NULL, 0);
+            if (opt.sweep_max < 1 || opt.sweep_max > MAX_PAYLOAD_CMDS)
+                usage(argv[0]);
+            break;
+        case OPT_SWEEP_BATCHES:
+            opt.sweep_batches = strtoull(optarg, NULL, 0);
+            if (opt.sweep_batches < 1)
+                usage(argv[0]);
+            break;
+        case OPT_GPU_TS:
+            opt.gpu_ts = true;
+            break;
+        case OPT_GPU_LOOP:
+            opt.gpu_loop = true;
+            break;
+        case OPT_EPOLL:
+            opt.epoll = true;
+            break;
+        case OPT_CONTROL:
+            opt.control = optarg;
+            break;
+        case OPT_PRIORITY:
+            opt.priority = parse_priority(optarg);
+            if (opt.priority < 0)
+                usage(argv[0]);
+            break;
+        case OPT_TIMESLICE:
+            opt.timeslice_us = strtoul(optarg, NULL, 0);
+            if (!opt.timeslice_us)
+                usage(argv[0]);
+            break;
+        case OPT_PREEMPT_TIMEOUT:
+            opt.preempt_timeout_us = strtoll(optarg, NULL, 0);
+            if (opt.preempt_timeout_us < 0)
+                usage(argv[0]);
+            break;
+        case OPT_PROBE:
+            opt.probe_rate = strtod(optarg, NULL);
+            if (opt.probe_rate <= 0)
+                usage(argv[0]);
+            break;
+        case OPT_PROBE_PRIORITY:
+            opt.probe_priority = parse_priority(optarg);
+            opt.probe_priority_set = true;
+            if (opt.probe_priority < 0)
+                usage(argv[0]);
+            break;
+        case OPT_LR:
+            opt.lr = true;
+            break;
+        case OPT_WIDTH:
+            opt.width = strtoul(optarg, NULL, 0);
+            if (opt.width < 1 || opt.width > MAX_GROUP)
+                usage(argv[0]);
+            break;
+        case OPT_VIRTUAL:
+            opt.virtual_engine = true;
+            break;
+        case OPT_PROCS:
+            opt.procs = strtoul(optarg, NULL, 0);
+            if (opt.procs < 1 || opt.procs > MAX_PROCS)
+                usage(argv[0]);
+            break;
+        case OPT_CPUS:
+            opt.cpus = optarg;
+            break;
+        case OPT_FIFO:
+            opt.fifo = optarg ? atoi(optarg) : 50;
+            if (opt.fifo < sched_get_priority_min(SCHED_FIFO) ||
+                opt.fifo > sched_get_priority_max(SCHED_FIFO))
+                usage(argv[0]);
+            break;
+        case OPT_MLOCK:
+            opt.mlock = true;
+            break;
+        case OPT_NO_RECOVER:
+            opt.recover = false;
+            break;
+        case OPT_WARMUP:
+            if (!strcmp(optarg, "auto")) {
+                opt.warmup_auto = true;
+                break;
+            }
+            opt.warmup = strtod(optarg, NULL);
+            if (opt.warmup <= 0)
+                usage(argv[0]);
+            break;
+        case OPT_DURATION:
+            opt.duration = strtod(optarg, NULL);
+            if (opt.duration <= 0)
+                usage(argv[0]);
+            break;
+        case OPT_ITERATIONS:
+            opt.iterations = strtoull(optarg, NULL, 0);
+            if (!opt.iterations)
+                usage(argv[0]);
+            break;
+        case OPT_UTIL:
+            opt.util = true;
+            break;
+        case OPT_BURST:
+            opt.burst = strtoull(optarg, NULL, 0);
+            if (!opt.burst)
+                usage(argv[0]);
+            break;
+        case OPT_IDLE_MS: {
+            double ms = strtod(optarg, NULL);
+
+            if (ms <= 0)
+                usage(argv[0]);
+            opt.idle_ns = (uint64_t)(ms * 1e6);
+            break;
+        }
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (opt.rate > 0 && opt.duty > 0) {
+        fprintf(stderr, "--rate and --duty are mutually exclusive\n");
+        usage(argv[0]);
+    }
+
+    bool warmup = opt.warmup > 0 || opt.warmup_auto;
+
+    /* a sweep runs a fixed number of batches per step already */
+    if (opt.sweep_max && (warmup || opt.duration > 0 || opt.iterations)) {
+        fprintf(stderr, "--sweep excludes --warmup, --duration and "
+                "--iterations\n");
+        usage(argv[0]);
+    }
+
+    /*
+     * bursts set their own pace and need the plain submit loop; any other
+     * queue or process would keep the GPU awake through the idle gaps
+     */
+    if (opt.burst && (opt.rate > 0 || opt.duty > 0 || opt.sweep_max ||
+                      opt.gpu_loop || opt.epoll || opt.probe_rate > 0 ||
+                      opt.queues_per_engine > 1 || opt.procs > 1)) {
+        fprintf(stderr, "--burst excludes --rate, --duty, --sweep, "
+                "--gpu-loop, --epoll, --probe, -q and --procs\n");
+        usage(argv[0]);
+    }
+
+    if (opt.gpu_loop) {
+        if (opt.rate > 0 || opt.duty > 0 || opt.sweep_max || opt.gpu_ts) {
+            fprintf(stderr, "--gpu-loop excludes --rate, --duty, --sweep "
+                    "and --gpu-ts\n");
+            usage(argv[0]);
+        }
+        /* one batch per second: nothing to warm up or count */
+        if (warmup || opt.iterations) {
+            fprintf(stderr, "--gpu-loop takes --duration only, no --warmup "
+                    "or --iterations\n");
+            usage(argv[0]);
+        }
+        /* the running loop plus the one queued behind it */
+        opt.depth = GPU_LOOP_SLOTS;
+    }
+
+    /*
+     * per-process copies would fight over the socket and sysfs values,
+     * and each would report the same device-wide PMU counters
+     */
+    if (opt.procs > 1 && (opt.control || opt.preempt_timeout_us >= 0 ||
+                          opt.util)) {
+        fprintf(stderr, "--procs excludes --control, --preempt-timeout-us "
+                "and --util\n");
+        usage(argv[0]);
+    }
+
+    if (opt.width > 1 || opt.virtual_engine) {
+        if (opt.width > 1 && opt.virtual_engine) {
+            fprintf(stderr, "--width and --virtual are exclusive\n");
+            usage(argv[0]);
+        }
+        /* the engine (and so its register base) is not fixed per batch */
+        if (opt.gpu_ts) {
+            fprintf(stderr, "--gpu-ts needs single-engine queues\n");
+            usage(argv[0]);
+        }
+    }
+
+    /*
+     * Exec queues on an LR VM may not signal dma-fences (syncobjs) on
+     * completion; user fences are the only way to learn about it.
+     */
+    if (opt.lr) {
+        if (opt.sync == SYNC_TIMELINE || opt.epoll) {
+            fprintf(stderr, "--lr completes through user fences only, "
+                    "no --timeline or --epoll\n");
+            usage(argv[0]);
+        }
+        opt.sync = SYNC_UFENCE;
+    }
+
+    if (opt.epoll) {
+        if (opt.rate > 0 || opt.duty > 0 || opt.sweep_max || opt.gpu_loop) {
+            fprintf(stderr, "--epoll excludes --rate, --duty, --sweep "
+                    "and --gpu-loop\n");
+            usage(argv[0]);
+        }
+        if (opt.sync == SYNC_UFENCE) {
+            fprintf(stderr, "--epoll needs syncobj completion, not --ufence\n");
+            usage(argv[0]);
+        }
+    } else if (opt.control) {
+        fprintf(stderr, "--control needs --epoll\n");
+        usage(argv[0]);
+    }
+
+    if (opt.probe_rate > 0) {
+        /* it sets the queues per engine itself */
+        if (opt.epoll || opt.gpu_loop || opt.sweep_max ||
+            opt.queues_per_engine > 1) {
+            fprintf(stderr, "--probe excludes --epoll, --gpu-loop, --sweep "
+                    "and -q\n");
+            usage(argv[0]);
+        }
+        opt.queues_per_engine = 2;    /* flood, probe */
+    }
+
+    /*
+     * The delay loop ends the whole batch, so it cannot sit inside a
+     * --gpu-loop batch, and engines of a parallel queue would share its
+     * pass counter.
+     */
+    if (opt.payload == PAYLOAD_DELAY && (opt.gpu_loop || opt.width > 1)) {
+        fprintf(stderr, "--payload delay excludes --gpu-loop and --width\n");
+        usage(argv[0]);
+    }
+
+    if (opt.sweep_max) {
+        if (!opt.payload_cmds)
+            opt.payload_cmds = 1;
+        if (opt.payload_cmds > opt.sweep_max) {
+            fprintf(stderr, "--sweep %u is below the --payload count %u\n",
+                    opt.sweep_max, opt.payload_cmds);
+            usage(argv[0]);
+        }
+    }
+
+    /* 0 passes would count down from 2^32 */
+    if (opt.payload == PAYLOAD_DELAY && !opt.payload_cmds) {
+        fprintf(stderr, "--payload delay needs N >= 1 passes\n");
+        usage(argv[0]);
+    }
+
+    if (optind < argc)
+        opt.node = argv[optind];
+}
+
+/* ---------- pacing ---------- */
+
+/*
+ * Sleep on a high-resolution timer until deadline (CLOCK_MONOTONIC_RAW
+ * ns), spinning out the last PACE_SPIN_NS to absorb wakeup latency.
+ * clock_nanosleep() cannot sleep on MONOTONIC_RAW, so sleep relative.
+ */
+static void sleep_until_ns(uint64_t deadline)
+{
+    for (;;) {
+        uint64_t now = now_ns();
+
+        if (now >= deadline || stop_requested)
+            return;
+
+        uint64_t left = deadline - now;
+        if (left > PACE_SPIN_NS) {
+            left -= PACE_SPIN_NS;
+            struct timespec ts = {
+                .tv_sec  = left / 1000000000ull,
+                .tv_nsec = left % 1000000000ull,
+            };
+            clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+        } else {
+            cpu_relax();
+        }
+    }
+}
+
+static void pacer_init(struct pacer *p, uint64_t now, double rate,
+                       double duty)
+{
+    p->target_rate = rate;
+    p->target_duty = duty;
+    /* --duty has no feed-forward until the first window measured a batch */
+    p->rate      = rate > 0 ? rate : 1000.0;
+    p->integral  = 0.0;
+    p->next_ns   = now;
+    p->win_start = now;
+    p->win_tail  = 0;
+    p->win_busy  = 0;
+}
+
+/* Wait for the next submission slot, then schedule the one after it. */
+static void pacer_wait(struct pacer *p)
+{
+    sleep_until_ns(p->next_ns);
+
+    uint64_t now = now_ns();
+    uint64_t period = (uint64_t)(1e9 / p->rate);
+
+    /* fell more than a period behind: do not burst to catch up */
+    p->next_ns += period;
+    if (p->next_ns + period < now)
+        p->next_ns = now + period;
+}
+
+/* PI update over the last window of completions. */
+static void pacer_update(struct pacer *p, const struct fence_ring *ring,
+                         uint64_t now)
+{
+    const double kp = 0.5, ki = 0.2, imax = 4.0;
+
+    if (now - p->win_start < PACE_WINDOW_NS)
+        return;
+
+    double   window  = (now - p->win_start) / 1e9;
+    uint64_t batches = ring->tail - p->win_tail;
+    uint64_t busy    = ring->busy_ns - p->win_busy;
+    double   target, measured, feed;
+
+    if (p->target_rate > 0) {
+        target   = p->target_rate;
+        measured = batches / window;
+        feed     = p->target_rate;
+    } else {
+        target   = p->target_duty;
+        measured = busy / (window * 1e9);
+        /* rate that yields the target duty at the measured service time */
+        feed     = batches ? p->target_duty * batches / (busy / 1e9 + 1e-9)
+                           : p->rate;
+    }
+
+    double err = (target - measured) / target;
+
+    p->integral += err;
+    if (p->integral > imax)
+        p->integral = imax;
+    if (p->integral < -imax)
+        p->integral = -imax;
+
+    p->rate = feed * (1.0 + kp * err + ki * p->integral);
+    if (p->rate < 1.0)
+        p->rate = 1.0;
+    if (p->rate > 1e7)
+        p->rate = 1e7;
+
+    p->win_start = now;
+    p->win_tail  = ring->tail;
+    p->win_busy  = ring->busy_ns;
+}
+
+/* ---------- batch payloads ---------- */
+
+static uint32_t payload_cmd_dwords(enum payload_kind kind)
+{
+    return kind == PAYLOAD_NOOP ? 1 : 4;
+}
+
+/* The delay loop, see emit_delay(); its size does not depend on N. */
+#define DELAY_DWORDS    26
+
+/*
+ * Batch size in bytes: the payload, the --gpu-ts timestamp stores around
+ * it or the --gpu-loop control flow, and MI_BATCH_BUFFER_END, qword padded.
+ */
+static uint64_t payload_batch_bytes(enum payload_kind kind, uint32_t cmds)
+{
+    uint64_t dwords = (kind == PAYLOAD_DELAY ? DELAY_DWORDS :
+                       (uint64_t)cmds * payload_cmd_dwords(kind)) + 1;
+
+    if (opt.gpu_ts || opt.gpu_loop)
+        dwords += 8;
+    return (dwords + 1) / 2 * 8;
+}
+
+/*
+ * Batches per BO: one per ring slot when each records its own timestamps,
+ * one per loop batch with --gpu-loop.
+ */
+static uint32_t batch_slots(void)
+{
+    return opt.gpu_loop ? GPU_LOOP_SLOTS : opt.gpu_ts ? opt.depth : 1;
+}
+
+static void emit_store_timestamp(uint32_t **b, uint32_t mmio_base,
+                                 uint64_t dst)
+{
+    *(*b)++ = MI_STORE_REGISTER_MEM;
+    *(*b)++ = RING_TIMESTAMP(mmio_base);
+    *(*b)++ = (uint32_t)dst;
+    *(*b)++ = (uint32_t)(dst >> 32);
+}
+
+/*
+ * Append cmds commands of kind at *bp. bo_addr is the GPU VA of the BO,
+ * for commands that address the data page.
+ */
+static void emit_payload(uint32_t **bp, uint64_t bo_addr,
+                         enum payload_kind kind, uint32_t cmds)
+{
+    uint32_t *b = *bp;
+    uint64_t sem = bo_addr + SEM_OFFSET;
+
+    for (uint32_t i = 0; i < cmds; i++) {
+        uint64_t dst = bo_addr + SCRATCH_OFFSET +
+                       (i % SCRATCH_DWORDS) * sizeof(uint32_t);
+
+        switch (kind) {
+        case PAYLOAD_STORE:
+            *b++ = MI_STORE_DWORD_IMM_GEN4;
+            *b++ = (uint32_t)dst;
+            *b++ = (uint32_t)(dst >> 32);
+            *b++ = i;
+            break;
+        case PAYLOAD_SEM:
+            /* condition already true: costs one CS memory poll */
+            *b++ = MI_SEMAPHORE_WAIT | MI_SEMAPHORE_POLL |
+                   MI_SEMAPHORE_SAD_EQ_SDD;
+            *b++ = SEM_READY;
+            *b++ = (uint32_t)sem;
+            *b++ = (uint32_t)(sem >> 32);
+            break;
+        default:
+            *b++ = MI_NOOP;
+            break;
+        }
+    }
+    *bp = b;
+}
+
+/*
+ * A loop of passes passes on the engine, which ends the batch when done:
+ * GPR0 counts down through MI_MATH and is stored to the data page, where
+ * MI_COND_BATCH_BUFFER_END can compare it. The GPRs are addressed
+ * relative to the executing engine, so any engine can run it. With
+ * mmio_base set, every pass stores the engine timestamp to ts_end, the
+ * last one recording when the loop finished.
+ */
+static void emit_delay(uint32_t **bp, uint64_t addr, uint64_t bo_addr,
+                       uint32_t passes, uint32_t mmio_base, uint64_t ts_end)
+{
+    uint32_t *b = *bp, *start = b;
+    uint64_t left = bo_addr + DELAY_OFFSET;
+
+    *b++ = MI_LOAD_REGISTER_IMM(4) | MI_LRI_CS_MMIO;
+    *b++ = CS_GPR(0);
+    *b++ = passes;
+    *b++ = CS_GPR(0) + 4;
+    *b++ = 0;
+    *b++ = CS_GPR(1);
+    *b++ = 1;
+    *b++ = CS_GPR(1) + 4;
+    *b++ = 0;
+
+    uint64_t loop = addr + (b - start) * sizeof(uint32_t);
+
+    *b++ = MI_ARB_CHECK;
+    *b++ = MI_MATH(4);
+    *b++ = MI_MATH_LOAD(MI_MATH_SRCA, 0);
+    *b++ = MI_MATH_LOAD(MI_MATH_SRCB, 1);
+    *b++ = MI_MATH_SUB;
+    *b++ = MI_MATH_STORE(0, MI_MATH_ACCU);
+    *b++ = MI_STORE_REGISTER_MEM | MI_SRM_CS_MMIO;
+    *b++ = CS_GPR(0);
+    *b++ = (uint32_t)left;
+    *b++ = (uint32_t)(left >> 32);
+    if (mmio_base)
+        emit_store_timestamp(&b, mmio_base, ts_end);
+    *b++ = MI_COND_BATCH_BUFFER_END | MI_DO_COMPARE;
+    *b++ = 0;                   /* end once *left <= 0 */
+    *b++ = (uint32_t)left;
+    *b++ = (uint32_t)(left >> 32);
+    *b++ = MI_BATCH_BUFFER_START;
+    *b++ = (uint32_t)loop;
+    *b++ = (uint32_t)(loop >> 32);
+    *bp = b;
+}
+
+/*
+ * Write one batch at start (GPU VA addr): cmds payload commands followed
+ * by MI_BATCH_BUFFER_END. bo_addr is the GPU VA of the BO, for commands
+ * that address the data page; with mmio_base set, the engine timestamp
+ * is stored to ts_addr before the payload and to ts_addr + 4 after it.
+ */
+static void payload_write(uint32_t *start, uint64_t addr, uint64_t bo_addr,
+                          enum payload_kind kind, uint32_t cmds,
+                          uint32_t mmio_base, uint64_t ts_addr)
+{
+    uint32_t *b = start;
+
+    if (mmio_base)
+        emit_store_timestamp(&b, mmio_base, ts_addr);
+
+    if (kind == PAYLOAD_DELAY) {
+        emit_delay(&b, addr + (b - start) * sizeof(uint32_t), bo_addr, cmds,
+                   mmio_base, ts_addr + sizeof(uint32_t));
+        *b++ = MI_BATCH_BUFFER_END;   /* not reached */
+        if ((b - start) & 1)
+            *b++ = MI_NOOP;
+        return;
+    }
+
+    emit_payload(&b, bo_addr, kind, cmds);
+
+    if (mmio_base)
+        emit_store_timestamp(&b, mmio_base, ts_addr + sizeof(uint32_t));
+
+    *b++ = MI_BATCH_BUFFER_END;
+    if ((b - start) & 1)
+        *b++ = MI_NOOP;    /* qword align */
+}
+
+/*
+ * A batch that runs its payload forever: each pass ends the batch if the
+ * run flag at flag_addr has been cleared to 0, otherwise it jumps back to
+ * its own start at addr. MI_ARB_CHECK keeps it preemptible.
+ */
+static void loop_write(uint32_t *start, uint64_t addr, uint64_t bo_addr,
+                       enum payload_kind kind, uint32_t cmds,
+                       uint64_t flag_addr)
+{
+    uint32_t *b = start;
+
+    *b++ = MI_ARB_CHECK;
+    *b++ = MI_COND_BATCH_BUFFER_END | MI_DO_COMPARE;
+    *b++ = 0;                   /* end if *flag_addr <= 0 */
+    *b++ = (uint32_t)flag_addr;
+    *b++ = (uint32_t)(flag_addr >> 32);
+
+    emit_payload(&b, bo_addr, kind, cmds);
+
+    *b++ = MI_BATCH_BUFFER_START;
+    *b++ = (uint32_t)addr;
+    *b++ = (uint32_t)(addr >> 32);
+    *b++ = MI_BATCH_BUFFER_END;  /* not reached */
+}
+
+/*
+ * Point exec at the batch at addr. A parallel queue takes one batch
+ * address per engine, passed as an array; every engine runs the same one.
+ */
+static void submitter_set_batch(struct submitter *s, struct drm_xe_exec *exec,
+                                uint64_t addr)
+{
+    exec->num_batch_buffer = s->group.width;
+    if (s->group.width == 1) {
+        exec->address = addr;
+        return;
+    }
+
+    for (uint32_t i = 0; i < s->group.width; i++)
+        s->batch_addrs[i] = addr;
+    exec->address = (uintptr_t)s->batch_addrs;
+}
+
+/* GPU VA of the batch for the next submission on s. */
+static uint64_t submitter_batch_addr(const struct submitter *s)
+{
+    uint32_t slot = batch_slots() > 1 ? s->ring.head % s->ring.depth : 0;
+
+    return s->addr + BATCH_OFFSET + slot * s->batch_stride;
+}
+
+/* (Re)write every batch slot of s for a payload of cmds commands. */
+static void submitter_write_batches(struct submitter *s, uint32_t cmds)
+{
+    for (uint32_t i = 0; i < batch_slots(); i++) {
+        uint64_t off = BATCH_OFFSET + i * s->batch_stride;
+
+        if (opt.gpu_loop) {
+            loop_write((uint32_t *)((uint8_t *)s->map + off), s->addr + off,
+                       s->addr, opt.payload, cmds,
+                       s->addr + LOOP_OFFSET + i * sizeof(uint32_t));
+            continue;
+        }
+        payload_write((uint32_t *)((uint8_t *)s->map + off), s->addr + off,
+                      s->addr, opt.payload, cmds,
+                      opt.gpu_ts ? s->mmio_base : 0,
+                      s->addr + TS_OFFSET + i * 2 * sizeof(uint32_t));
+    }
+}
+
+static uint32_t vm_create(int fd)
+{
+    struct drm_xe_vm_create vmc = {
+        .extensions = 0,
+        .flags      = opt.lr ? DRM_XE_VM_CREATE_FLAG_LR_MODE : 0,
+        .vm_id      = 0,
+    };
+
+    if (ioctl(fd, DRM_IOCTL_XE_VM_CREATE, &vmc) < 0)
+        die("DRM_IOCTL_XE_VM_CREATE");
+
+    return vmc.vm_id;
+}
+
+/* Map (or unmap) the submitter's BO at s->addr in s->vm_id, synchronously. */
+static void submitter_bind(struct submitter *s, uint32_t op)
+{
+    struct drm_xe_vm_bind bind = {
+        .extensions    = 0,
+        .vm_id         = s->vm_id,
+        .exec_queue_id = 0,      /* default VM-bind engine */
+        .pad           = 0,
+        .num_binds     = 1,
+        .num_syncs     = 0,      /* syncs only for ASYNC bind */
+        .syncs         = 0,
+    };
+
+    bind.bind.extensions  = 0;
+    bind.bind.obj         = op == DRM_XE_VM_BIND_OP_MAP ? s->bo_handle : 0;
+    bind.bind.pat_index   = 0;        /* simple PAT */
+    bind.bind.obj_offset  = 0;
+    bind.bind.range       = s->bo_size;
+    bind.bind.addr        = s->addr;
+    bind.bind.op          = op;
+    bind.bind.flags       = 0;
+    bind.bind.prefetch_mem_region_instance = 0;
+    bind.bind.pad2        = 0;
+
+    if (ioctl(s->fd, DRM_IOCTL_XE_VM_BIND, &bind) < 0)
+        die(op == DRM_XE_VM_BIND_OP_MAP ? "DRM_IOCTL_XE_VM_BIND"
+                                        : "DRM_IOCTL_XE_VM_BIND unmap");
+}
+
+/*
+ * Create the exec queue for s->group in s->vm_id with the scheduling
+ * properties from the options. False (errno set) if the kernel refused.
+ */
+static bool submitter_create_queue(struct submitter *s)
+{
+    struct drm_xe_ext_set_property props[2];
+    uint64_t ext = 0;
+    uint32_t nprops = 0;
+
+    if (s->priority >= 0) {
+        props[nprops] = (struct drm_xe_ext_set_property) {
+            .base.name = DRM_XE_EXEC_QUEUE_EXTENSION_SET_PROPERTY,
+            .property  = DRM_XE_EXEC_QUEUE_SET_PROPERTY_PRIORITY,
+            .value     = s->priority,
+        };
+        nprops++;
+    }
+    if (opt.timeslice_us) {
+        props[nprops] = (struct drm_xe_ext_set_property) {
+            .base.name = DRM_XE_EXEC_QUEUE_EXTENSION_SET_PROPERTY,
+            .property  = DRM_XE_EXEC_QUEUE_SET_PROPERTY_TIMESLICE,
+            .value     = opt.timeslice_us,
+        };
+        nprops++;
+    }
+    for (uint32_t i = nprops; i-- > 0; ) {
+        props[i].base.next_extension = ext;
+        ext = (uintptr_t)&props[i];
+    }
+
+    struct drm_xe_exec_queue_create execq = {
+        .extensions     = ext,
+        .width          = s->group.width,
+        .num_placements = s->group.num_placements,
+        .vm_id          = s->vm_id,
+        .flags          = 0,
+        .exec_queue_id  = 0,
+        .instances      = (uintptr_t)s->group.inst,
+    };
+
+    if (ioctl(s->fd, DRM_IOCTL_XE_EXEC_QUEUE_CREATE, &execq) < 0)
+        return false;
+
+    s->exec_queue_id = execq.exec_queue_id;
+    return true;
+}
+
+/*
+ * Create s's BO private to s->vm_id (it can never be bound in another
+ * VM), map it and write the batches for a payload of cmds commands.
+ */
+static void submitter_create_bo(struct submitter *s, uint32_t cmds)
+{
+    int fd = s->fd;
+
+    /* 1) Create GEM buffer attached to the shared VM */
+    struct drm_xe_gem_create gcreate = {
+        .extensions  = 0,
+        .size        = s->bo_size,
+        .placement   = s->placement,
+        .flags       = 0,
+        .vm_id       = s->vm_id,
+        .handle      = 0,
+        .cpu_caching = DRM_XE_GEM_CPU_CACHING_WB,
+    };
+
+    if (ioctl(fd, DRM_IOCTL_XE_GEM_CREATE, &gcreate) < 0)
+        die("DRM_IOCTL_XE_GEM_CREATE");
+
+    s->bo_handle = gcreate.handle;
+
+    /* 2) mmap the BO */
+    struct drm_xe_gem_mmap_offset mmo = {
+        .extensions = 0,
+        .handle     = s->bo_handle,
+        .flags      = 0,
+        .offset     = 0,
+    };
+
+    if (ioctl(fd, DRM_IOCTL_XE_GEM_MMAP_OFFSET, &mmo) < 0)
+        die("DRM_IOCTL_XE_GEM_MMAP_OFFSET");
+
+    s->map = mmap(NULL, s->bo_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, mmo.offset);
+    if (s->map == MAP_FAILED)
+        die("mmap BO");
+
+    /* 3) Write the batch(es) after the data page */
+    *(volatile uint32_t *)((uint8_t *)s->map + SEM_OFFSET) = SEM_READY;
+    submitter_write_batches(s, cmds);
+}
+
+/* Point the ring's user fences and --gpu-ts slots at s's BO. */
+static void submitter_attach_bo(struct submitter *s)
+{
+    if (opt.sync == SYNC_UFENCE)
+        fence_ring_attach_ufence(&s->ring, (uint8_t *)s->map + UFENCE_OFFSET,
+                                 s->addr + UFENCE_OFFSET);
+    if (opt.gpu_ts)
+        fence_ring_attach_gpu_ts(&s->ring, (uint8_t *)s->map + TS_OFFSET,
+                                 &s->clock);
+}
+
+/* Create, map, fill and bind this submitter's BO, its exec queue and fences. */
+static void submitter_setup(struct submitter *s, uint32_t placement,
+                            uint64_t stride)
+{
+    int fd = s->fd;
+
+    s->addr      = BIND_ADDRESS + s->index * stride;
+    s->placement = placement;
+
+    if (opt.gpu_ts) {
+        s->mmio_base = engine_mmio_base(&s->inst);
+        if (!s->mmio_base) {
+            fprintf(stderr, "%s: register base unknown, no --gpu-ts\n",
+                    s->name);
+            exit(EXIT_FAILURE);
+        }
+        gpu_clock_init(fd, &s->inst, &s->clock);
+    }
+    submitter_create_bo(s, opt.payload_cmds);
+
+    /* 4) Bind BO into the VM at s->addr */
+    submitter_bind(s, DRM_XE_VM_BIND_OP_MAP);
+
+    /* 5) Create exec queue for this engine + VM, with scheduling properties */
+    bool created = submitter_create_queue(s);
+
+    if (!created && errno == EPERM && s->priority > 1 && s->priority_fallback) {
+        fprintf(stderr, "%s: high priority needs CAP_SYS_NICE, "
+                "using normal\n", s->name);
+        s->priority = 1;
+        created = submitter_create_queue(s);
+    }
+    if (!created) {
+        if (errno == EPERM && s->priority > 1)
+            fprintf(stderr, "high priority needs CAP_SYS_NICE\n");
+        if (errno == EINVAL && s->group.width > 1)
+            fprintf(stderr, "%s: engines not usable for parallel submission\n",
+                    s->name);
+        die("DRM_IOCTL_XE_EXEC_QUEUE_CREATE");
+    }
+
+    /* 6) Create the out-fences: a syncobj ring or one timeline */
+    fence_ring_init(fd, &s->ring, opt.sync, s->depth, s->exec_queue_id);
+    submitter_attach_bo(s);
+
+    printf("Queue %-10s class=%u instance=%u gt_id=%u exec_queue=%u "
+           "bo=%u va=0x%" PRIx64 " cpu=%d prio=%d width=%u placements=%u\n",
+           s->name, s->inst.engine_class, s->inst.engine_instance,
+           s->inst.gt_id, s->exec_queue_id, s->bo_handle, s->addr, s->cpu,
+           s->priority, s->group.width, s->group.num_placements);
+}
+
+/*
+ * Undo submitter_setup once the ring has drained: the queue first, so
+ * nothing can still reference the fences or the BO being released.
+ */
+static void submitter_teardown(struct submitter *s)
+{
+    int fd = s->fd;
+
+    struct drm_xe_exec_queue_destroy qdestroy = {
+        .exec_queue_id = s->exec_queue_id,
+    };
+
+    if (ioctl(fd, DRM_IOCTL_XE_EXEC_QUEUE_DESTROY, &qdestroy) < 0)
+        die("DRM_IOCTL_XE_EXEC_QUEUE_DESTROY");
+
+    fence_ring_fini(fd, &s->ring);
+    munmap(s->map, s->bo_size);
+    if (s->vm_gen == s->vm->gen)     /* else our VM was banned and is gone */
+        submitter_bind(s, DRM_XE_VM_BIND_OP_UNMAP);
+
+    struct drm_gem_close gclose = { .handle = s->bo_handle };
+
+    if (ioctl(fd, DRM_IOCTL_GEM_CLOSE, &gclose) < 0)
+        die("DRM_IOCTL_GEM_CLOSE");
+}
+
+/* ---------- hang and ban recovery ---------- */
+
+/* A wall-clock and run-time stamped event line on stderr, apart from reports. */
+__attribute__((format(printf, 2, 3)))
+static void submitter_log(const struct submitter *s, const char *fmt, ...)
+{
+    struct timespec ts;
+    struct tm tm;
+    char when[32];
+    va_list ap;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    localtime_r(&ts.tv_sec, &tm);
+    strftime(when, sizeof(when), "%F %T", &tm);
+
+    pthread_mutex_lock(&report_lock);
+    fprintf(stderr, "%s.%03ld [%8.1fs] %s: ", when, ts.tv_nsec / 1000000,
+            (now_ns() - run_start) / 1e9, s->name);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    pthread_mutex_unlock(&report_lock);
+}
+
+static bool exec_queue_banned(int fd, uint32_t exec_queue_id)
+{
+    struct drm_xe_exec_queue_get_property prop = {
+        .exec_queue_id = exec_queue_id,
+        .property      = DRM_XE_EXEC_QUEUE_GET_PROPERTY_BAN,
+    };
+
+    if (ioctl(fd, DRM_IOCTL_XE_EXEC_QUEUE_GET_PROPERTY, &prop) < 0)
+        die("DRM_IOCTL_XE_EXEC_QUEUE_GET_PROPERTY");
+
+    return prop.value;
+}
+
+/*
+ * s's exec queue was reset or banned (err: the exec errno, 0 if a fence
+ * wait found out). Count the batches in flight as lost, replace the
+ * queue, and the shared VM too if it was banned with it, and record the
+ * time from the last completion until the new queue is ready.
+ */
+static void submitter_recover(struct submitter *s, int err)
+{
+    int fd = s->fd;
+    uint64_t detected = now_ns();
+    uint64_t since = s->ring.last_done ? s->ring.last_done : detected;
+    uint64_t lost = s->ring.head - s->ring.tail;
+    uint32_t old_id = s->exec_queue_id;
+    bool banned = exec_queue_banned(fd, old_id);
+
+    submitter_log(s, "exec queue %u %s (%s), %" PRIu64 " batches in flight",
+                  old_id, banned ? "banned" : "reset",
+                  err ? strerror(err) : "found waiting", lost);
+    if (!opt.recover)
+        exit(EXIT_FAILURE);
+
+    struct drm_xe_exec_queue_destroy qdestroy = { .exec_queue_id = old_id };
+
+    ioctl(fd, DRM_IOCTL_XE_EXEC_QUEUE_DESTROY, &qdestroy);  /* best effort */
+
+    pthread_mutex_lock(&s->vm->lock);
+    if (s->vm_gen != s->vm->gen || !submitter_create_queue(s)) {
+        if (s->vm_gen == s->vm->gen) {
+            /* our VM refuses new queues: banned, replace it for everyone */
+            struct drm_xe_vm_destroy vmd = { .vm_id = s->vm->id };
+
+            ioctl(fd, DRM_IOCTL_XE_VM_DESTROY, &vmd);
+            s->vm->id = vm_create(fd);
+            s->vm->gen++;
+            submitter_log(s, "VM %u replaced by VM %u", vmd.vm_id, s->vm->id);
+        }
+        /*
+         * Our BO is private to the old VM and cannot be bound in the
+         * new one: replace it with a fresh copy (in-flight contents such
+         * as user fences are moot, those batches are lost anyway).
+         */
+        struct drm_gem_close gclose = { .handle = s->bo_handle };
+
+        munmap(s->map, s->bo_size);
+        if (ioctl(fd, DRM_IOCTL_GEM_CLOSE, &gclose) < 0)
+            die("DRM_IOCTL_GEM_CLOSE");
+        s->vm_id  = s->vm->id;
+        s->vm_gen = s->vm->gen;
+        submitter_create_bo(s, s->window.cmds);
+        submitter_attach_bo(s);
+        submitter_bind(s, DRM_XE_VM_BIND_OP_MAP);
+        if (!submitter_create_queue(s))
+            die("DRM_IOCTL_XE_EXEC_QUEUE_CREATE");
+    }
+    pthread_mutex_unlock(&s->vm->lock);
+
+    fence_ring_reset(fd, &s->ring, s->exec_queue_id);
+
+    uint64_t ready = now_ns();
+
+    hist_add(&s->window.recovery, ready - since);
+    s->window.lost += lost;
+    submitter_log(s, "recovered on exec queue %u in %.1f ms "
+                  "(%.1f ms after detection)", s->exec_queue_id,
+                  (ready - since) / 1e6, (ready - detected) / 1e6);
+}
+
+/*
+ * Wait for the oldest batch in flight and record it, in BAN_POLL_NS
+ * slices so that a hung queue being banned is noticed. A lost queue is
+ * replaced, dropping what was in flight; either way there is room in
+ * the ring afterwards.
+ */
+static void submitter_retire(struct submitter *s)
+{
+    while (!fence_ring_try_retire(s->fd, &s->ring, &s->window,
+                                  BAN_POLL_NS)) {
+        if (s->ring.lost || exec_queue_banned(s->fd, s->exec_queue_id)) {
+            submitter_recover(s, 0);
+            return;
+        }
+    }
+}
+
+/* ---------- run length: warm-up, duration, iterations ---------- */
+
+/* Start s's statistics at run_start, in warm-up if one was asked for. */
+static void submitter_begin(struct submitter *s, uint32_t cmds)
+{
+    stats_reset(&s->total, run_start);
+    stats_reset(&s->window, run_start);
+    s->total.cmds = s->window.cmds = cmds;
+
+    s->measuring    = !opt.warmup && !opt.warmup_auto;
+    s->done         = false;
+    s->end_ns       = 0;
+    memset(&s->steady, 0, sizeof(s->steady));
+    s->steady.next_ns = run_start + STEADY_WINDOW_NS;
+}
+
+/* Relative spread (max - min) / mean of v[0..n); 1 if all zero. */
+static double spread(const double *v, uint32_t n)
+{
+    double lo = v[0], hi = v[0], sum = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        lo = v[i] < lo ? v[i] : lo;
+        hi = v[i] > hi ? v[i] : hi;
+        sum += v[i];
+    }
+    return sum > 0 ? (hi - lo) / (sum / n) : 1.0;
+}
+
+/*
+ * Close a --warmup auto window if one has ended. True once the last
+ * STEADY_WINDOWS windows agree on rate and mean latency.
+ */
+static bool steady_sample(struct submitter *s, uint64_t now)
+{
+    struct steady *sd = &s->steady;
+    uint64_t count = s->total.latency.count + s->window.latency.count;
+    uint64_t sum   = s->total.latency.sum + s->window.latency.sum;
+
+    if (now < sd->next_ns)
+        return false;
+
+    uint32_t slot = sd->n++ % STEADY_WINDOWS;
+    double secs = (now - (sd->next_ns - STEADY_WINDOW_NS)) / 1e9;
+
+    sd->rate[slot] = (count - sd->count) / secs;
+    sd->lat[slot]  = count > sd->count ?
+                     (double)(sum - sd->sum) / (count - sd->count) : 0;
+    sd->count   = count;
+    sd->sum     = sum;
+    sd->next_ns = now + STEADY_WINDOW_NS;
+
+    return sd->n >= STEADY_WINDOWS &&
+           spread(sd->rate, STEADY_WINDOWS) <= STEADY_TOLERANCE &&
+           spread(sd->lat, STEADY_WINDOWS) <= STEADY_TOLERANCE;
+}
+
+/*
+ * Called by the submit loops after each batch: ends the warm-up when it
+ * is due, dropping everything recorded so far, and returns true once s
+ * has been measured for --duration or --iterations. Batches submitted
+ * during the warm-up that complete after it are measured, so
+ * --iterations counts those already recorded plus those in flight: once
+ * the ring is drained exactly N have been measured.
+ */
+static bool submitter_phase(struct submitter *s, uint64_t now)
+{
+    if (!s->measuring) {
+        uint64_t warm = now - run_start;
+
+        if (opt.warmup_auto) {
+            if (steady_sample(s, now))
+                submitter_log(s, "steady after %.1fs of warm-up, measuring",
+                              warm / 1e9);
+            else if (warm >= STEADY_MAX_NS)
+                submitter_log(s, "not steady after %.0fs, measuring anyway",
+                              warm / 1e9);
+            else
+                return false;
+        } else if (warm < opt.warmup * 1e9) {
+            return false;
+        }
+
+        stats_reset(&s->total, now);
+        stats_reset(&s->window, now);
+        s->measuring = true;
+        return false;
+    }
+
+    if (opt.duration > 0 && now - s->total.start_ns >= opt.duration * 1e9)
+        return true;
+    uint64_t measured = s->total.latency.count + s->window.latency.count;
+
+    return opt.iterations &&
+           measured + (s->ring.head - s->ring.tail) >= opt.iterations;
+}
+
+/* Submitter thread: keep the queue fed until stop_requested. */
+static void *submitter_run(void *arg)
+{
+    struct submitter *s = arg;
+    int fd = s->fd;
+
+    struct drm_xe_sync sync = {
+        .extensions     = 0,
+        .type           = DRM_XE_SYNC_TYPE_SYNCOBJ, /* set per submit */
+        .flags          = DRM_XE_SYNC_FLAG_SIGNAL,  /* signal on completion */
+        .handle         = 0,                        /* set per submit */
+        .timeline_value = 0,                        /* set per submit */
+    };
+
+    struct drm_xe_exec exec = {
+        .extensions       = 0,
+        .exec_queue_id    = s->exec_queue_id,
+        .num_syncs        = 1,
+        .syncs            = (uintptr_t)&sync,
+        .address          = 0,               /* set per submit */
+        .num_batch_buffer = 1,               /* set per submit */
+    };
+
+    /* a sweep reports once per step instead of periodically */
+    uint64_t interval_ns = opt.sweep_max ? 0 : (uint64_t)(opt.interval * 1e9);
+    uint64_t next_report = run_start + interval_ns;
+    uint32_t cmds = opt.payload_cmds;
+    uint64_t step_start = 0;
+    uint64_t burst_start = 0;   /* ring.head at the current burst's start */
+
+    submitter_begin(s, cmds);
+
+    bool paced = s->rate > 0 || s->duty > 0;
+
+    if (paced) {
+        /* hrtimer sleeps should not be rounded up by the default 50us slack */
+        prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+        pacer_init(&s->pacer, run_start, s->rate, s->duty);
+    }
+
+    while (!stop_requested) {
+        if (paced) {
+            fence_ring_retire_until(fd, &s->ring, &s->window,
+                                    s->pacer.next_ns);
+            if (s->ring.lost)
+                submitter_recover(s, 0);
+            pacer_update(&s->pacer, &s->ring, now_ns());
+            pacer_wait(&s->pacer);
+            if (stop_requested)
+                break;
+        }
+
+        /*
+         * Burst boundary (and before the first one): drain, then leave the
+         * engine idle long enough to drop into a power-saving state, so
+         * the next batch pays for waking it up.
+         */
+        if (opt.burst && (!s->ring.head ||
+                          s->ring.head - burst_start >= opt.burst)) {
+            while (!fence_ring_empty(&s->ring))
+                submitter_retire(s);
+            sleep_until_ns(now_ns() + opt.idle_ns);
+            if (stop_requested)
+                break;
+            burst_start = s->ring.head;
+        }
+
+        /* Ring full: wait only for the oldest batch to complete */
+        if (fence_ring_full(&s->ring))
+            submitter_retire(s);
+
+        /* Binary: reset this slot's syncobj; timeline: next point */
+        fence_ring_prepare(fd, &s->ring, &sync);
+
+        /* Submit batch (--gpu-ts: the copy owned by this ring slot) */
+        submitter_set_batch(s, &exec, submitter_batch_addr(s));
+        exec.exec_queue_id = s->exec_queue_id;   /* new after a recovery */
+        uint64_t t_submit = now_ns();
+        if (ioctl(fd, DRM_IOCTL_XE_EXEC, &exec) < 0) {
+            if (!queue_lost_errno(errno))
+                die("DRM_IOCTL_XE_EXEC");
+            submitter_recover(s, errno);
+            continue;
+        }
+        uint64_t t_submitted = now_ns();
+        bool first = s->ring.head == burst_start;
+
+        fence_ring_push(&s->ring, t_submit, t_submitted)->first = first;
+
+        if (opt.gpu_ts && t_submitted >= s->clock.next_ns)
+            gpu_clock_sync(fd, &s->inst, &s->clock);
+
+        if (opt.sweep_max && s->ring.head - step_start == opt.sweep_batches) {
+            /* Idle the queue so the batch can be rewritten for the next step */
+            while (!fence_ring_empty(&s->ring))
+                submitter_retire(s);
+
+            uint64_t now = now_ns();
+            stats_report(&s->window, "sweep", s->name, now);
+            stats_merge(&s->total, &s->window);
+            stats_reset(&s->window, now);
+            if (cmds >= opt.sweep_max)
+                break;
+
+            cmds = cmds > opt.sweep_max / 2 ? opt.sweep_max : cmds * 2;
+            submitter_write_batches(s, cmds);
+            s->window.cmds = cmds;
+            step_start = s->ring.head;
+            continue;
+        }
+
+        bool warming = !s->measuring;
+
+        if (submitter_phase(s, t_submitted))
+            break;
+        if (warming && s->measuring)     /* report intervals from here */
+            next_report = t_submitted + interval_ns;
+
+        if (interval_ns && t_submitted >= next_report) {
+            stats_report(&s->window, s->measuring ? "interval" : "warmup",
+                         s->name, t_submitted);
+            stats_merge(&s->total, &s->window);
+            stats_reset(&s->window, t_submitted);
+            next_report += interval_ns;
+            if (next_report <= t_submitted)
+                next_report = t_submitted + interval_ns;
+        }
+    }
+
+    /* Let batches still in flight complete so they count in the total */
+    while (!fence_ring_empty(&s->ring))
+        submitter_retire(s);
+
+    s->end_ns = now_ns();
+    stats_merge(&s->total, &s->window);
+    return NULL;
+}
+
+/*
+ * --gpu-loop thread: the engine runs self-looping batches, so the CPU only
+ * submits once per GPU_LOOP_PERIOD_NS. Each rotation queues the other loop
+ * batch behind the running one before clearing the running one's flag,
+ * so the engine never drains.
+ */
+static void *submitter_loop(void *arg)
+{
+    struct submitter *s = arg;
+    int fd = s->fd;
+    volatile uint32_t *run = (uint32_t *)((uint8_t *)s->map + LOOP_OFFSET);
+
+    struct drm_xe_sync sync = {
+        .extensions     = 0,
+        .type           = DRM_XE_SYNC_TYPE_SYNCOBJ, /* set per submit */
+        .flags          = DRM_XE_SYNC_FLAG_SIGNAL,
+        .handle         = 0,
+        .timeline_value = 0,
+    };
+
+    struct drm_xe_exec exec = {
+        .extensions       = 0,
+        .exec_queue_id    = s->exec_queue_id,
+        .num_syncs        = 1,
+        .syncs            = (uintptr_t)&sync,
+        .address          = 0,               /* set per submit */
+        .num_batch_buffer = 1,               /* set per submit */
+    };
+
+    uint64_t interval_ns = (uint64_t)(opt.interval * 1e9);
+    uint64_t next_report = run_start + interval_ns;
+    struct timespec cpu_start, cpu_end;
+
+    submitter_begin(s, opt.payload_cmds);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+    for (uint64_t n = 0; !stop_requested && !s->done; n++) {
+        uint32_t slot = n % GPU_LOOP_SLOTS;
+
+        __atomic_store_n(&run[slot], 1, __ATOMIC_RELEASE);
+        fence_ring_prepare(fd, &s->ring, &sync);
+        submitter_set_batch(s, &exec,
+                            s->addr + BATCH_OFFSET + slot * s->batch_stride);
+
+        uint64_t t_submit = now_ns();
+        if (ioctl(fd, DRM_IOCTL_XE_EXEC, &exec) < 0)
+            die("DRM_IOCTL_XE_EXEC");
+        uint64_t t_submitted = now_ns();
+
+        fence_ring_push(&s->ring, t_submit, t_submitted);
+
+        /* hand over: the previous loop finishes its pass and ends */
+        if (n) {
+            __atomic_store_n(&run[(n - 1) % GPU_LOOP_SLOTS], 0,
+                             __ATOMIC_RELEASE);
+            fence_ring_retire(fd, &s->ring, &s->window);
+        }
+
+        uint64_t rotate = t_submitted + GPU_LOOP_PERIOD_NS;
+        uint64_t now;
+
+        while (!stop_requested && (now = now_ns()) < rotate) {
+            if ((s->done = submitter_phase(s, now)))
+                break;
+            /* short sleeps so Ctrl+C and reports are not held up */
+            sleep_until_ns(now + 10000000ull < rotate ? now + 10000000ull
+                                                      : rotate);
+
+            now = now_ns();
+            if (interval_ns && now >= next_report) {
+                stats_report(&s->window, "interval", s->name, now);
+                stats_merge(&s->total, &s->window);
+                stats_reset(&s->window, now);
+                next_report += interval_ns;
+                if (next_report <= now)
+                    next_report = now + interval_ns;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < GPU_LOOP_SLOTS; i++)
+        __atomic_store_n(&run[i], 0, __ATOMIC_RELEASE);
+    while (!fence_ring_empty(&s->ring))
+        fence_ring_retire(fd, &s->ring, &s->window);
+    s->end_ns = now_ns();
+    stats_merge(&s->total, &s->window);
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    double cpu = (cpu_end.tv_sec - cpu_start.tv_sec) +
+                 (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+    double wall = (now_ns() - run_start) / 1e9;
+    double pct = wall > 0 ? cpu / wall * 100.0 : 0.0;
+    /* CSV rows have a fixed schema; keep this out of it */
+    FILE *out = opt.format == FORMAT_CSV ? stderr : report_out;
+
+    pthread_mutex_lock(&report_lock);
+    if (opt.format == FORMAT_JSON)
+        fprintf(out, "{\"scope\":\"cpu\",\"queue\":\"%s\",\"elapsed_s\":%.3f"
+                ",\"cpu_pct\":%.3f}\n", s->name, wall, pct);
+    else
+        fprintf(out, "%s: GPU loop used %.3f%% of a CPU over %.1fs\n",
+                s->name, pct, wall);
+    fflush(out);
+    pthread_mutex_unlock(&report_lock);
+    return NULL;
+}
+
+/* ---------- --epoll event loop ---------- */
+
+enum {
+    EV_QUEUE,       /* a submitter's completion eventfd; low bits: index */
+    EV_TIMER,       /* periodic report timerfd */
+    EV_LISTEN,      /* control socket */
+    EV_CLIENT,      /* control connection; low bits: control_clients[] slot */
+};
+
+#define EV_KEY(type, n)  ((uint64_t)(type) << 32 | (uint32_t)(n))
+
+static void epoll_add(int epfd, int fd, uint64_t key)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = key };
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        die("epoll_ctl");
+}
+
+/* Submit the next batch on s without waiting for anything. */
+static void submitter_exec(struct submitter *s)
+{
+    struct drm_xe_sync sync = {
+        .flags = DRM_XE_SYNC_FLAG_SIGNAL,
+    };
+    struct drm_xe_exec exec = {
+        .exec_queue_id    = s->exec_queue_id,
+        .num_syncs        = 1,
+        .syncs            = (uintptr_t)&sync,
     };
 
-    if (ioctl(fd, DRM_IOCTL_XE_GEM_MMAP_OFFSET, &mmo) < 0)
-        die("DRM_IOCTL_XE_GEM_MMAP_OFFSET");
+    submitter_set_batch(s, &exec, submitter_batch_addr(s));
+    fence_ring_prepare(s->fd, &s->ring, &sync);
+
+    uint64_t t_submit = now_ns();
+    if (ioctl(s->fd, DRM_IOCTL_XE_EXEC, &exec) < 0)
+        die("DRM_IOCTL_XE_EXEC");
+    uint64_t t_submitted = now_ns();
+
+    fence_ring_push(&s->ring, t_submit, t_submitted);
+
+    if (opt.gpu_ts && t_submitted >= s->clock.next_ns)
+        gpu_clock_sync(s->fd, &s->inst, &s->clock);
+}
+
+/*
+ * The oldest batch on s completed: retire everything that has, top the
+ * ring back up to --depth and wait for the new oldest batch.
+ */
+static void submitter_complete(struct submitter *s)
+{
+    uint64_t count;
+
+    if (read(s->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        die("read eventfd");
+
+    while (!fence_ring_empty(&s->ring) &&
+           fence_ring_try_retire(s->fd, &s->ring, &s->window, 0))
+        ;
+
+    while (!stop_requested && !s->done && !fence_ring_full(&s->ring)) {
+        submitter_exec(s);
+        s->done = submitter_phase(s, now_ns());
+    }
+
+    if (!fence_ring_empty(&s->ring))
+        fence_ring_arm_eventfd(s->fd, &s->ring, s->efd);
+    else if (!s->end_ns)
+        s->end_ns = now_ns();
+}
+
+static int control_listen(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int sock;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "control socket path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        die("socket");
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        die(path);
+    if (listen(sock, 8) < 0)
+        die("listen");
+    return sock;
+}
+
+/*
+ * Write a reply to the non-blocking client socket, giving up after
+ * CONTROL_TIMEOUT_MS: a client that does not read must not hold up the
+ * completions of every queue.
+ */
+static void control_reply(int client, const char *buf, size_t len)
+{
+    uint64_t deadline = now_ns() + CONTROL_TIMEOUT_MS * 1000000ull;
+
+    while (len) {
+        ssize_t n = write(client, buf, len);
+
+        if (n > 0) {
+            buf += n;
+            len -= n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR)
+            return;
+
+        uint64_t now = now_ns();
+        struct pollfd pfd = { .fd = client, .events = POLLOUT };
+
+        if (now >= deadline)
+            return;
+        poll(&pfd, 1, (deadline - now) / 1000000 + 1);
+    }
+}
+
+/*
+ * A control connection still sending its command line; fd -1 if the
+ * slot is free. Dropped unanswered after its deadline.
+ */
+static struct control_client {
+    int      fd;
+    uint64_t deadline;
+    size_t   len;
+    char     buf[128];
+} control_clients[MAX_CONTROL_CLIENTS];
+
+/*
+ * One command per connection: "stats" answers with a line per queue
+ * covering the run so far, "stop" ends the run as Ctrl+C would.
+ */
+static void control_command(int client, const char *cmd,
+                            struct submitter *subs, uint32_t count)
+{
+    /* rendered in memory first, then sent without blocking */
+    char *reply = NULL;
+    size_t reply_len = 0;
+    FILE *out = open_memstream(&reply, &reply_len);
+    if (!out)
+        return;
+
+    if (!strcmp(cmd, "stats")) {
+        static struct stats snap;
+        uint64_t now = now_ns();
+
+        for (uint32_t i = 0; i < count; i++) {
+            snap = subs[i].total;
+            stats_merge(&snap, &subs[i].window);
+            stats_report_to(out, &snap, "snapshot", subs[i].name, now);
+        }
+    } else if (!strcmp(cmd, "stop")) {
+        stop_requested = 1;
+        fprintf(out, "ok\n");
+    } else {
+        fprintf(out, "error: unknown command '%s'\n", cmd);
+    }
+    fclose(out);
+    control_reply(client, reply, reply_len);
+    free(reply);
+}
+
+/* Take a new connection on the listening socket, if a slot is free. */
+static void control_accept(int epfd, int sock)
+{
+    int fd = accept4(sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (fd < 0)
+        return;
+    for (uint32_t i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+        struct control_client *c = &control_clients[i];
+
+        if (c->fd >= 0)
+            continue;
+        c->fd       = fd;
+        c->deadline = now_ns() + CONTROL_CLIENT_MS * 1000000ull;
+        c->len      = 0;
+        epoll_add(epfd, fd, EV_KEY(EV_CLIENT, i));
+        return;
+    }
+    close(fd);    /* busy: the client sees the connection drop */
+}
+
+static void control_close(struct control_client *c)
+{
+    close(c->fd);    /* also drops it from the epoll set */
+    c->fd = -1;
+}
+
+/*
+ * Collect input from c up to a newline (or until it is full or the peer
+ * stops sending), then run the command and hang up.
+ */
+static void control_read(struct control_client *c, struct submitter *subs,
+                         uint32_t count)
+{
+    ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n < 0 || (n == 0 && !c->len)) {
+        control_close(c);
+        return;
+    }
+    c->len += n;
+    c->buf[c->len] = '\0';
+
+    char *eol = strpbrk(c->buf, "\r\n");
+
+    if (!eol && n > 0 && c->len < sizeof(c->buf) - 1)
+        return;       /* the rest of the line is still to come */
+    if (eol)
+        *eol = '\0';
+    control_command(c->fd, c->buf, subs, count);
+    control_close(c);
+}
+
+/* Drop clients past their deadline; ms until the next one, -1 if none. */
+static int control_expire(void)
+{
+    uint64_t now = now_ns(), next = UINT64_MAX;
+
+    for (uint32_t i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+        struct control_client *c = &control_clients[i];
+
+        if (c->fd < 0)
+            continue;
+        if (now >= c->deadline)
+            control_close(c);
+        else if (c->deadline < next)
+            next = c->deadline;
+    }
+    return next == UINT64_MAX ? -1 : (int)((next - now) / 1000000 + 1);
+}
+
+/*
+ * --epoll: one thread keeps every queue --depth deep. Completions arrive
+ * as syncobj eventfds, periodic reports on a timerfd and commands on the
+ * optional control socket, so no single fence ever blocks the loop.
+ */
+static void event_loop(struct submitter *subs, uint32_t count)
+{
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int tfd = -1, sock = -1;
+    uint32_t busy = 0, finished = 0;
+
+    if (epfd < 0)
+        die("epoll_create1");
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct submitter *s = &subs[i];
+
+        submitter_begin(s, opt.payload_cmds);
+
+        s->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (s->efd < 0)
+            die("eventfd");
+        epoll_add(epfd, s->efd, EV_KEY(EV_QUEUE, i));
+
+        while (!fence_ring_full(&s->ring))
+            submitter_exec(s);
+        fence_ring_arm_eventfd(s->fd, &s->ring, s->efd);
+    }
+
+    if (opt.interval > 0) {
+        uint64_t ns = (uint64_t)(opt.interval * 1e9);
+        struct itimerspec its = {
+            .it_interval = { ns / 1000000000ull, ns % 1000000000ull },
+            .it_value    = { ns / 1000000000ull, ns % 1000000000ull },
+        };
+
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (tfd < 0 || timerfd_settime(tfd, 0, &its, NULL) < 0)
+            die("timerfd");
+        epoll_add(epfd, tfd, EV_KEY(EV_TIMER, 0));
+    }
+
+    if (opt.control) {
+        for (uint32_t i = 0; i < MAX_CONTROL_CLIENTS; i++)
+            control_clients[i].fd = -1;
+        sock = control_listen(opt.control);
+        epoll_add(epfd, sock, EV_KEY(EV_LISTEN, 0));
+        printf("Control socket %s\n", opt.control);
+    }
+
+    /* after stop_requested, run until every ring has drained */
+    do {
+        struct epoll_event events[64];
+        int n = epoll_wait(epfd, events, ARRAY_SIZE(events),
+                           opt.control ? control_expire() : -1);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            die("epoll_wait");
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint32_t type = events[i].data.u64 >> 32;
+            uint32_t idx  = (uint32_t)events[i].data.u64;
+
+            switch (type) {
+            case EV_QUEUE:
+                submitter_complete(&subs[idx]);
+                break;
+            case EV_TIMER: {
+                uint64_t ticks, now = now_ns();
+
+                if (read(tfd, &ticks, sizeof(ticks)) < 0 && errno != EAGAIN)
+                    die("read timerfd");
+                for (uint32_t q = 0; q < count; q++) {
+                    struct submitter *s = &subs[q];
+
+                    if (s->done)
+                        continue;
+                    stats_report(&s->window,
+                                 s->measuring ? "interval" : "warmup",
+                                 s->name, now);
+                    stats_merge(&s->total, &s->window);
+                    stats_reset(&s->window, now);
+                }
+                break;
+            }
+            case EV_LISTEN:
+                control_accept(epfd, sock);
+                break;
+            case EV_CLIENT:
+                control_read(&control_clients[idx], subs, count);
+                break;
+            }
+        }
+
+        busy = finished = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            busy += !fence_ring_empty(&subs[i].ring);
+            finished += subs[i].done;
+        }
+    } while ((!stop_requested && finished < count) || busy);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!subs[i].end_ns)
+            subs[i].end_ns = now_ns();
+        stats_merge(&subs[i].total, &subs[i].window);
+        close(subs[i].efd);
+    }
+    if (sock >= 0) {
+        for (uint32_t i = 0; i < MAX_CONTROL_CLIENTS; i++)
+            if (control_clients[i].fd >= 0)
+                control_close(&control_clients[i]);
+        close(sock);
+        unlink(opt.control);
+    }
+    if (tfd >= 0)
+        close(tfd);
+    close(epfd);
+}
+
+/* ---------- CPU placement and scheduling ---------- */
 
-    void *map = mmap(NULL, BO_SIZE, PROT_READ | PROT_WRITE,
-                     MAP_SHARED, fd, mmo.offset);
-    if (map == MAP_FAILED)
-        die("mmap BO");
+/* Parse a kernel cpulist ("0-3,8,10-11") into set. */
+static bool parse_cpulist(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
 
-    printf("BO mapped at %p\n", map);
+    CPU_ZERO(set);
+    while (*p && *p != '\n') {
+        char *end;
+        unsigned long lo = strtoul(p, &end, 10), hi = lo;
 
-    /* 5) Write a tiny batch: just MI_BATCH_BUFFER_END */
-    uint32_t *batch = (uint32_t *)map;
-    batch[0] = MI_BATCH_BUFFER_END;
-    batch[1] = 0;   /* padding / NOOP */
-    /* msync removed: not needed and may return EINVAL */
+        if (end == p)
+            return false;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtoul(p, &end, 10);
+            if (end == p || hi < lo)
+                return false;
+        }
+        for (unsigned long c = lo; c <= hi && c < CPU_SETSIZE; c++)
+            CPU_SET(c, set);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return CPU_COUNT(set) > 0;
+}
 
-    /* 6) Bind BO into the VM at BIND_ADDRESS (synchronous bind) */
-    struct drm_xe_vm_bind bind = {
-        .extensions    = 0,
-        .vm_id         = vm_id,
-        .exec_queue_id = 0,      /* default VM-bind engine */
-        .pad           = 0,
-        .num_binds     = 1,
-        .num_syncs     = 0,      /* syncs only for ASYNC bind */
-        .syncs         = 0,
-    };
+/* The CPUs on the GPU's NUMA node, from its PCI device in sysfs. */
+static bool gpu_local_cpus(int fd, cpu_set_t *set)
+{
+    char path[PATH_MAX], buf[4096];
+    struct stat st;
+    FILE *f;
+    bool ok;
 
-    bind.bind.extensions  = 0;
-    bind.bind.obj         = bo_handle;
-    bind.bind.pat_index   = 0;        /* simple PAT */
-    bind.bind.obj_offset  = 0;
-    bind.bind.range       = BO_SIZE;
-    bind.bind.addr        = BIND_ADDRESS;
-    bind.bind.op          = DRM_XE_VM_BIND_OP_MAP;
-    bind.bind.flags       = 0;
-    bind.bind.prefetch_mem_region_instance = 0;
-    bind.bind.pad2        = 0;
+    if (fstat(fd, &st) < 0)
+        return false;
+    snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/local_cpulist",
+             major(st.st_rdev), minor(st.st_rdev));
 
-    if (ioctl(fd, DRM_IOCTL_XE_VM_BIND, &bind) < 0)
-        die("DRM_IOCTL_XE_VM_BIND");
+    f = fopen(path, "r");
+    if (!f)
+        return false;
+    ok = fgets(buf, sizeof(buf), f) && parse_cpulist(buf, set);
+    fclose(f);
+    return ok;
+}
 
-    printf("BO bound at VA 0x%llx\n",
-           (unsigned long long)BIND_ADDRESS);
+/*
+ * CPUs to pin submitters to, in order: --cpus, else the GPU-local CPUs,
+ * else everything; always limited to our affinity mask. Returns how many
+ * and says which in *source.
+ */
+static int submit_cpus(int fd, int *cpus, const char **source)
+{
+    cpu_set_t allowed, want;
+    int n = 0;
 
-    /* 7) Pick a RENDER engine instance */
-    struct drm_xe_engine_class_instance inst = pick_render_engine(fd);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        die("sched_getaffinity");
 
-    printf("Using RENDER engine: class=%u instance=%u gt_id=%u\n",
-           inst.engine_class, inst.engine_instance, inst.gt_id);
+    *source = "all allowed";
+    if (opt.cpus) {
+        if (!parse_cpulist(opt.cpus, &want)) {
+            fprintf(stderr, "Bad CPU list %s\n", opt.cpus);
+            exit(EXIT_FAILURE);
+        }
+        CPU_AND(&want, &want, &allowed);
+        if (!CPU_COUNT(&want)) {
+            fprintf(stderr, "None of CPUs %s is allowed\n", opt.cpus);
+            exit(EXIT_FAILURE);
+        }
+        allowed = want;
+        *source = "--cpus";
+    } else if (gpu_local_cpus(fd, &want)) {
+        CPU_AND(&want, &want, &allowed);
+        if (CPU_COUNT(&want)) {
+            allowed = want;
+            *source = "GPU-local";
+        }
+    }
 
-    /* 8) Create exec queue for that engine + VM */
-    struct drm_xe_exec_queue_create execq = {
-        .extensions     = 0,
-        .width          = 1,            /* 1 slot */
-        .num_placements = 1,            /* 1 engine */
-        .vm_id          = vm_id,
-        .flags          = 0,
-        .exec_queue_id  = 0,
-        .instances      = (uintptr_t)&inst,
-    };
+    for (int c = 0; c < CPU_SETSIZE; c++)
+        if (CPU_ISSET(c, &allowed))
+            cpus[n++] = c;
+    return n;
+}
 
-    if (ioctl(fd, DRM_IOCTL_XE_EXEC_QUEUE_CREATE, &execq) < 0)
-        die("DRM_IOCTL_XE_EXEC_QUEUE_CREATE");
+/* Format cpus[0..n) back into cpulist form. */
+static void format_cpulist(const int *cpus, int n, char *buf, size_t len)
+{
+    size_t off = 0;
+
+    buf[0] = '\0';
+    for (int i = 0; i < n && off < len; ) {
+        int j = i;
 
-    uint32_t exec_queue_id = execq.exec_queue_id;
-    printf("Exec queue created: id=%u\n", exec_queue_id);
+        while (j + 1 < n && cpus[j + 1] == cpus[j] + 1)
+            j++;
+        off += snprintf(buf + off, len - off, "%s%d", i ? "," : "", cpus[i]);
+        if (j > i && off < len)
+            off += snprintf(buf + off, len - off, "-%d", cpus[j]);
+        i = j + 1;
+    }
+}
 
-    /* 9) Create a syncobj to use as an out-fence repeatedly */
-    uint32_t sync_handle = create_syncobj(fd);
+/* --fifo for threads created with attr. */
+static void attr_set_fifo(pthread_attr_t *attr)
+{
+    struct sched_param sp = { .sched_priority = opt.fifo };
 
-    struct drm_xe_sync sync = {
-        .extensions     = 0,
-        .type           = DRM_XE_SYNC_TYPE_SYNCOBJ,
-        .flags          = DRM_XE_SYNC_FLAG_SIGNAL,  /* signal on completion */
-        .handle         = sync_handle,
-        .timeline_value = 0,                        /* not used by binary */
+    if (!opt.fifo)
+        return;
+    pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+    pthread_attr_setschedparam(attr, &sp);
+}
+
+/* ---------- engine utilisation: Xe PMU and fdinfo ---------- */
+
+/*
+ * Cumulative counters per engine class at one instant. The PMU counts
+ * device-wide engine-active-ticks against engine-total-ticks; fdinfo
+ * counts only this client's drm-cycles against drm-total-cycles.
+ */
+struct util_counters {
+    uint64_t ns;
+    uint64_t batches[NUM_ENGINE_CLASSES];      /* retired by our queues */
+    uint64_t pmu_active[NUM_ENGINE_CLASSES];
+    uint64_t pmu_total[NUM_ENGINE_CLASSES];
+    uint64_t fd_cycles[NUM_ENGINE_CLASSES];
+    uint64_t fd_total[NUM_ENGINE_CLASSES];
+};
+
+static struct {
+    int       fd;                /* DRM fd whose fdinfo we read */
+    bool      used[NUM_ENGINE_CLASSES];
+    uint32_t  capacity[NUM_ENGINE_CLASSES];    /* engines behind fdinfo */
+    struct {
+        int      active, total;  /* perf event fds */
+        uint16_t engine_class;
+    } pmu[MAX_PMU_ENGINES];
+    uint32_t  num_pmu;
+    bool      fdinfo;            /* the kernel reports drm-cycles-* */
+    const struct submitter *subs;
+    uint32_t  count;
+    pthread_t thread;
+    volatile bool stop;
+} util;
+
+/* Read a whole (small) sysfs/procfs file into buf; false if unreadable. */
+static bool read_file(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+    size_t n;
+
+    if (!f)
+        return false;
+    n = fread(buf, 1, len - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    return n > 0;
+}
+
+/*
+ * OR value into *config at the bits PMU format field name occupies
+ * ("config:20-27" or "config:12" in format/<name>).
+ */
+static bool pmu_set_field(const char *pmu, const char *name, uint64_t value,
+                          uint64_t *config)
+{
+    char path[PATH_MAX], buf[64];
+    unsigned int lo, hi;
+
+    snprintf(path, sizeof(path), "%s/format/%s", pmu, name);
+    if (!read_file(path, buf, sizeof(buf)))
+        return false;
+
+    int n = sscanf(buf, "config:%u-%u", &lo, &hi);
+    if (n < 1 || lo > 63)
+        return false;
+    if (n == 1)
+        hi = lo;
+
+    uint64_t mask = hi - lo >= 63 ? ~0ull : (1ull << (hi - lo + 1)) - 1;
+    *config |= (value & mask) << lo;
+    return true;
+}
+
+/* Open the PMU event named event (events/<event>: "event=0x02,...") for e. */
+static int pmu_open(const char *pmu, uint32_t type, int cpu, const char *event,
+                    const struct drm_xe_engine_class_instance *e)
+{
+    char path[PATH_MAX], buf[256], *save = NULL;
+    uint64_t config = 0;
+
+    snprintf(path, sizeof(path), "%s/events/%s", pmu, event);
+    if (!read_file(path, buf, sizeof(buf)))
+        return -1;
+
+    for (char *term = strtok_r(buf, ",\n", &save); term;
+         term = strtok_r(NULL, ",\n", &save)) {
+        char *eq = strchr(term, '=');
+
+        if (!eq)
+            return -1;
+        *eq = '\0';
+        if (!pmu_set_field(pmu, term, strtoull(eq + 1, NULL, 0), &config))
+            return -1;
+    }
+    if (!pmu_set_field(pmu, "gt", e->gt_id, &config) ||
+        !pmu_set_field(pmu, "engine_class", e->engine_class, &config) ||
+        !pmu_set_field(pmu, "engine_instance", e->engine_instance, &config))
+        return -1;
+
+    struct perf_event_attr attr = {
+        .type   = type,
+        .size   = sizeof(attr),
+        .config = config,
     };
 
-    /* Prepare EXEC struct – now with one sync */
-    struct drm_xe_exec exec = {
-        .extensions       = 0,
-        .exec_queue_id    = exec_queue_id,
-        .num_syncs        = 1,
-        .syncs            = (uintptr_t)&sync,
-        .address          = BIND_ADDRESS,    /* GPU VA of batch */
-        .num_batch_buffer = 1,
+    return syscall(SYS_perf_event_open, &attr, -1, cpu, -1,
+                   PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+ * Open engine-active-ticks/engine-total-ticks for every engine we
+ * submit to, on the PMU registered for fd's PCI device.
+ */
+static void util_open_pmu(int fd, const struct drm_xe_engine_class_instance *engines,
+                          uint32_t num_engines)
+{
+    char path[PATH_MAX], link[PATH_MAX], pmu[256], buf[64];
+    struct stat st;
+    ssize_t n;
+
+    if (fstat(fd, &st) < 0)
+        return;
+    snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device",
+             major(st.st_rdev), minor(st.st_rdev));
+    n = readlink(path, link, sizeof(link) - 1);
+    if (n < 0) {
+        printf("Xe PMU: no device behind %s\n", path);
+        return;
+    }
+    link[n] = '\0';
+
+    /* PCI 0000:03:00.0 registers as xe_0000_03_00.0 */
+    const char *bus_id = strrchr(link, '/') ? strrchr(link, '/') + 1 : link;
+    int len = snprintf(pmu, sizeof(pmu), "/sys/bus/event_source/devices/xe_");
+    for (const char *c = bus_id; *c && len < (int)sizeof(pmu) - 1; c++)
+        pmu[len++] = *c == ':' ? '_' : *c;
+    pmu[len] = '\0';
+
+    snprintf(path, sizeof(path), "%s/type", pmu);
+    if (!read_file(path, buf, sizeof(buf))) {
+        printf("Xe PMU: %s not found (kernel without it?)\n", pmu);
+        return;
+    }
+    uint32_t type = strtoul(buf, NULL, 0);
+
+    snprintf(path, sizeof(path), "%s/cpumask", pmu);
+    int cpu = read_file(path, buf, sizeof(buf)) ? atoi(buf) : 0;
+
+    for (uint32_t i = 0; i < num_engines && util.num_pmu < MAX_PMU_ENGINES; i++) {
+        int active = pmu_open(pmu, type, cpu, "engine-active-ticks", &engines[i]);
+        int total  = active < 0 ? -1 :
+                     pmu_open(pmu, type, cpu, "engine-total-ticks", &engines[i]);
+
+        if (total < 0) {
+            printf("Xe PMU: cannot open engine events: %s%s\n", strerror(errno),
+                   errno == EACCES ? " (needs CAP_PERFMON or "
+                                     "perf_event_paranoid <= 0)" : "");
+            if (active >= 0)
+                close(active);
+            return;
+        }
+        util.pmu[util.num_pmu].active = active;
+        util.pmu[util.num_pmu].total  = total;
+        util.pmu[util.num_pmu].engine_class = engines[i].engine_class;
+        util.num_pmu++;
+    }
+}
+
+static int engine_class_by_name(const char *name)
+{
+    for (int c = 0; c < NUM_ENGINE_CLASSES; c++)
+        if (engine_class_name(c) && !strcmp(engine_class_name(c), name))
+            return c;
+    return -1;
+}
+
+/* This client's drm-cycles-* and drm-total-cycles-* from its fdinfo. */
+static bool util_read_fdinfo(struct util_counters *c)
+{
+    char path[64], line[256], name[16];
+    uint64_t value;
+    bool found = false;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", util.fd);
+    f = fopen(path, "r");
+    if (!f)
+        return false;
+
+    while (fgets(line, sizeof(line), f)) {
+        int cls;
+
+        if (sscanf(line, "drm-cycles-%15[a-z]: %" SCNu64, name, &value) == 2 &&
+            (cls = engine_class_by_name(name)) >= 0) {
+            c->fd_cycles[cls] = value;
+            found = true;
+        } else if (sscanf(line, "drm-total-cycles-%15[a-z]: %" SCNu64,
+                          name, &value) == 2 &&
+                   (cls = engine_class_by_name(name)) >= 0) {
+            c->fd_total[cls] = value;
+        } else if (sscanf(line, "drm-engine-capacity-%15[a-z]: %" SCNu64,
+                          name, &value) == 2 &&
+                   (cls = engine_class_by_name(name)) >= 0) {
+            util.capacity[cls] = value;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+static void util_sample(struct util_counters *c)
+{
+    memset(c, 0, sizeof(*c));
+    c->ns = now_ns();
+
+    for (uint32_t i = 0; i < util.count; i++) {
+        const struct submitter *s = &util.subs[i];
+
+        c->batches[s->inst.engine_class] +=
+            __atomic_load_n(&s->ring.tail, __ATOMIC_RELAXED);
+    }
+    for (uint32_t i = 0; i < util.num_pmu; i++) {
+        uint64_t active = 0, total = 0;
+
+        if (read(util.pmu[i].active, &active, sizeof(active)) < 0 ||
+            read(util.pmu[i].total, &total, sizeof(total)) < 0)
+            die("read PMU counter");
+        c->pmu_active[util.pmu[i].engine_class] += active;
+        c->pmu_total[util.pmu[i].engine_class]  += total;
+    }
+    if (util.fdinfo)
+        util_read_fdinfo(c);
+}
+
+/* One line per engine class in use for the counters between a and b. */
+static void util_report(const char *scope, const struct util_counters *a,
+                        const struct util_counters *b)
+{
+    double window = (b->ns - a->ns) / 1e9;
+    double elapsed = (b->ns - run_start) / 1e9;
+    /* CSV rows have a fixed schema; keep these out of it */
+    FILE *out = opt.format == FORMAT_CSV ? stderr : report_out;
+
+    pthread_mutex_lock(&report_lock);
+    for (int c = 0; c < NUM_ENGINE_CLASSES; c++) {
+        uint64_t pmu_total = b->pmu_total[c] - a->pmu_total[c];
+        uint64_t fd_total  = b->fd_total[c] - a->fd_total[c];
+        double rate = window > 0 ? (b->batches[c] - a->batches[c]) / window : 0;
+        double pmu = pmu_total ?
+                     100.0 * (b->pmu_active[c] - a->pmu_active[c]) / pmu_total : -1;
+        double fdi = fd_total ?
+                     100.0 * (b->fd_cycles[c] - a->fd_cycles[c]) /
+                     (fd_total * (util.capacity[c] ? util.capacity[c] : 1)) : -1;
+        char queue[16];
+
+        if (!util.used[c])
+            continue;
+        snprintf(queue, sizeof(queue), "util.%s", engine_class_name(c));
+
+        if (opt.format == FORMAT_JSON) {
+            fprintf(out, "{\"scope\":\"%s\",\"queue\":\"%s\",\"elapsed_s\":%.3f"
+                    ",\"subs_per_s\":%.1f", scope, queue, elapsed, rate);
+            if (pmu >= 0)
+                fprintf(out, ",\"pmu_busy_pct\":%.1f", pmu);
+            if (fdi >= 0)
+                fprintf(out, ",\"fdinfo_busy_pct\":%.1f", fdi);
+            fprintf(out, "}\n");
+            continue;
+        }
+
+        fprintf(out, "[%8.1fs] %-8s %-10s %10.0f subs/s  engine busy  PMU ",
+                elapsed, scope, queue, rate);
+        if (pmu >= 0)
+            fprintf(out, "%5.1f%%", pmu);
+        else
+            fprintf(out, "%s", "  n/a ");
+        fprintf(out, "  fdinfo ");
+        if (fdi >= 0)
+            fprintf(out, "%5.1f%%\n", fdi);
+        else
+            fprintf(out, "%s\n", "  n/a");
+    }
+    fflush(out);
+    pthread_mutex_unlock(&report_lock);
+}
+
+/* True once every queue has finished its warm-up. */
+static bool util_measuring(void)
+{
+    for (uint32_t i = 0; i < util.count; i++)
+        if (!__atomic_load_n(&util.subs[i].measuring, __ATOMIC_RELAXED))
+            return false;
+    return true;
+}
+
+/*
+ * Sampler thread: a line per class every --interval, a total at the end.
+ * Like the per-queue totals, the total covers the measurement only: it
+ * starts when the last queue's warm-up ends (or at run_start if the run
+ * is stopped before that).
+ */
+static void *util_run(void *arg)
+{
+    uint64_t interval_ns = (uint64_t)(opt.interval * 1e9);
+    struct util_counters first, prev, cur;
+    bool measuring = util_measuring();
+
+    (void)arg;
+    util_sample(&first);
+    prev = first;
+
+    while (!util.stop) {
+        sleep_until_ns(now_ns() + 10000000ull);   /* notice util.stop soon */
+        if (!measuring && util_measuring()) {
+            util_sample(&first);
+            prev = first;
+            measuring = true;
+            continue;
+        }
+        if (!interval_ns || now_ns() < prev.ns + interval_ns)
+            continue;
+        util_sample(&cur);
+        util_report(measuring ? "interval" : "warmup", &prev, &cur);
+        prev = cur;
+    }
+
+    util_sample(&cur);
+    util_report("total", &first, &cur);
+    return NULL;
+}
+
+/* Open the counters for the engines we submit to, before submitting. */
+static void util_init(int fd, const struct drm_xe_engine_class_instance *engines,
+                      uint32_t num_engines, const struct submitter *subs,
+                      uint32_t count)
+{
+    struct util_counters probe;
+
+    util.fd    = fd;
+    util.subs  = subs;
+    util.count = count;
+    for (uint32_t i = 0; i < num_engines; i++)
+        util.used[engines[i].engine_class] = true;
+
+    util_open_pmu(fd, engines, num_engines);
+    memset(&probe, 0, sizeof(probe));
+    util.fdinfo = util_read_fdinfo(&probe);
+    if (!util.fdinfo)
+        printf("fdinfo: no drm-cycles-* keys for this client\n");
+}
+
+static void util_start(void)
+{
+    int err = pthread_create(&util.thread, NULL, util_run, NULL);
+    if (err) {
+        errno = err;
+        die("pthread_create");
+    }
+}
+
+static void util_stop(void)
+{
+    util.stop = true;
+    pthread_join(util.thread, NULL);
+    for (uint32_t i = 0; i < util.num_pmu; i++) {
+        close(util.pmu[i].active);
+        close(util.pmu[i].total);
+    }
+}
+
+/* One queue's totals, sent from a --procs child to the parent. */
+struct proc_result {
+    char         name[24];
+    uint64_t     end_ns;
+    struct stats st;
+};
+
+/*
+ * Write all of buf: a proc_result is far larger than PIPE_BUF, and a
+ * signal can interrupt it part way.
+ */
+static void write_full(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = write(fd, (const uint8_t *)buf + done, len - done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            die("write results");
+        done += n;
+    }
+}
+
+/*
+ * Open the device, build the VM and exec queues and run them until
+ * stopped. With result_fd >= 0 (a --procs child) the per-queue totals are
+ * written there instead of being reported.
+ */
+static int run_client(int result_fd)
+{
+    const char *node = opt.node;
+    int fd = open_render_node(node);
+    if (fd < 0)
+        return EXIT_FAILURE;
+
+    printf("Opened %s\n", node);
+
+    /* 1) Create VM shared by all exec queues */
+    static struct shared_vm vm = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+    vm.id = vm_create(fd);
+    printf("VM created: id=%u%s\n", vm.id, opt.lr ? " (long-running)" : "");
+
+    /* 2) Pick memory placement; BOs are spaced by its page size */
+    uint32_t min_page_size = 0;
+    uint32_t placement = pick_sysmem_placement(fd, &min_page_size);
+
+    if (!placement) {
+        fprintf(stderr, "WARNING: placement mask is 0, GEM_CREATE may fail\n");
+    }
+
+    uint32_t max_cmds = opt.sweep_max ? opt.sweep_max : opt.payload_cmds;
+    uint64_t batch_stride = (payload_batch_bytes(opt.payload, max_cmds) + 63) /
+                            64 * 64;
+    uint64_t bo_size = BATCH_OFFSET +
+        (batch_slots() * batch_stride + DATA_SIZE - 1) / DATA_SIZE * DATA_SIZE;
+    uint64_t stride = (bo_size + min_page_size - 1) / min_page_size *
+                      min_page_size;
+
+    /* 3) Pick engines, group them into exec queues, one submitter each */
+    uint32_t num_engines, num_groups;
+    struct drm_xe_engine_class_instance *engines =
+        select_engines(fd, &num_engines);
+    struct engine_group *groups = group_engines(engines, num_engines,
+                                                &num_groups);
+    uint32_t count = num_groups * opt.queues_per_engine;
+
+    if (opt.preempt_timeout_us >= 0)
+        engine_sysfs_set(fd, engines, num_engines, "preempt_timeout_us",
+                         opt.preempt_timeout_us);
+
+    if (count > MAX_SUBMITTERS) {
+        fprintf(stderr, "%u exec queues requested, max %d\n",
+                count, MAX_SUBMITTERS);
+        return EXIT_FAILURE;
+    }
+    if (opt.burst && count > 1) {
+        fprintf(stderr, "--burst needs a single exec queue (one engine), "
+                "not %u\n", count);
+        return EXIT_FAILURE;
+    }
+
+    struct submitter *subs = calloc(count, sizeof(*subs));
+    if (!subs)
+        die("calloc submitters");
+
+    static int cpus[CPU_SETSIZE];
+    const char *cpu_source;
+    int num_cpus = submit_cpus(fd, cpus, &cpu_source);
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct submitter *s = &subs[i];
+        uint32_t q = i % opt.queues_per_engine;
+
+        s->fd    = fd;
+        s->vm    = &vm;
+        s->vm_id = vm.id;
+        s->bo_size = bo_size;
+        s->batch_stride = batch_stride;
+        s->index = i;
+        s->group = groups[i / opt.queues_per_engine];
+        s->inst  = s->group.inst[0];
+        s->cpu   = opt.pin && !opt.epoll ?
+                   cpus[(proc_index * count + i) % num_cpus] : -1;
+
+        bool probe = opt.probe_rate > 0 && q == 1;
+
+        s->depth    = probe ? 1 : opt.depth;
+        s->rate     = probe ? opt.probe_rate : opt.rate;
+        s->duty     = probe ? 0 : opt.duty;
+        s->priority = probe ? opt.probe_priority : opt.priority;
+        s->priority_fallback = probe && !opt.probe_priority_set;
+
+        int len = 0;
+        if (opt.procs > 1)
+            len = snprintf(s->name, sizeof(s->name), "p%u.", proc_index);
+        if (s->inst.gt_id)
+            len += snprintf(s->name + len, sizeof(s->name) - len, "gt%u.",
+                            s->inst.gt_id);
+        len += snprintf(s->name + len, sizeof(s->name) - len, "%s",
+                        engine_class_name(s->inst.engine_class));
+        if (s->group.num_placements > 1)
+            len += snprintf(s->name + len, sizeof(s->name) - len, "*");
+        else if (s->group.width > 1)
+            len += snprintf(s->name + len, sizeof(s->name) - len, "%u-%u",
+                            s->inst.engine_instance,
+                            s->group.inst[s->group.width - 1].engine_instance);
+        else
+            len += snprintf(s->name + len, sizeof(s->name) - len, "%u",
+                            s->inst.engine_instance);
+        if (opt.probe_rate > 0)
+            snprintf(s->name + len, sizeof(s->name) - len,
+                     probe ? ".probe" : ".flood");
+        else if (opt.queues_per_engine > 1)
+            snprintf(s->name + len, sizeof(s->name) - len, ".%u", q);
+
+        submitter_setup(s, placement, stride);
+    }
+    if (opt.util)
+        util_init(fd, engines, num_engines, subs, count);
+    free(groups);
+    free(engines);
+
+    static const char *const sync_names[] = {
+        [SYNC_BINARY]   = "binary syncobj",
+        [SYNC_TIMELINE] = "timeline syncobj",
+        [SYNC_UFENCE]   = "user fence",
+    };
+    static const char *const payload_names[] = {
+        [PAYLOAD_NOOP]  = "MI_NOOP",
+        [PAYLOAD_STORE] = "MI_STORE_DWORD_IMM",
+        [PAYLOAD_SEM]   = "MI_SEMAPHORE_WAIT",
+        [PAYLOAD_DELAY] = "delay loop pass",
     };
+    printf("Submitting on %u queue(s) with %s, depth=%u.\n",
+           count, sync_names[opt.sync], opt.depth);
+    if (opt.probe_rate > 0)
+        printf("Probe: one depth 1 queue per engine at %.0f batches/s.\n",
+               opt.probe_rate);
+    if (opt.sweep_max)
+        printf("Payload: %u..%u x %s, %" PRIu64 " batches per step.\n",
+               opt.payload_cmds, opt.sweep_max, payload_names[opt.payload],
+               opt.sweep_batches);
+    else
+        printf("Payload: %u x %s (%" PRIu64 " byte batch).\n",
+               opt.payload_cmds, payload_names[opt.payload],
+               payload_batch_bytes(opt.payload, opt.payload_cmds));
+    if (opt.pin) {
+        char list[256];
 
-    printf("Entering infinite submit loop with syncobj.\n");
-    printf("Kill this process (Ctrl+C) to stop.\n");
+        format_cpulist(cpus, num_cpus, list, sizeof(list));
+        printf("CPUs: %s (%s)", list, cpu_source);
+    } else {
+        printf("CPUs: unpinned");
+    }
+    if (opt.fifo)
+        printf(", SCHED_FIFO %d", opt.fifo);
+    printf("%s.\n", opt.mlock ? ", memory locked" : "");
+    if (opt.warmup_auto)
+        printf("Warm-up: until steady (at most %.0fs).\n", STEADY_MAX_NS / 1e9);
+    else if (opt.warmup > 0)
+        printf("Warm-up: %.1fs.\n", opt.warmup);
+    if (opt.duration > 0 && opt.iterations)
+        printf("Measuring each queue for %.1fs or %" PRIu64 " batches.\n",
+               opt.duration, opt.iterations);
+    else if (opt.duration > 0)
+        printf("Measuring each queue for %.1fs.\n", opt.duration);
+    else if (opt.iterations)
+        printf("Measuring each queue for %" PRIu64 " batches.\n",
+               opt.iterations);
+    if (opt.burst)
+        printf("Bursts: %" PRIu64 " batches, each after %.1f ms idle.\n",
+               opt.burst, opt.idle_ns / 1e6);
+    printf("Press Ctrl+C (or send SIGTERM) to stop and print the summary, "
+           "again to abort.\n");
 
-    /* 10) Keep submitting the same tiny batch forever */
-    while (1) {
-        /* Reset syncobj to unsignaled state before each submit */
-        reset_syncobj(fd, sync_handle);
+    install_stop_handlers();
+    if (opt.control)
+        signal(SIGPIPE, SIG_IGN);   /* control clients may hang up early */
 
-        /* Submit batch */
-        if (ioctl(fd, DRM_IOCTL_XE_EXEC, &exec) < 0)
-            die("DRM_IOCTL_XE_EXEC");
+    /* 4) One submitter thread per exec queue, optionally pinned, or one
+     *    event loop on this thread for all of them */
+    run_start = now_ns();
+    if (opt.util)
+        util_start();
 
-        /* Wait until GPU signals syncobj (batch completed) */
-        wait_syncobj(fd, sync_handle);
+    if (opt.mlock && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        die("mlockall (check RLIMIT_MEMLOCK)");
 
-        /* Optional: reduce CPU usage slightly
-         * usleep(1000); // 1ms sleep
-         */
+    if (opt.epoll) {
+        /* the event loop is this thread: place and schedule it instead */
+        if (opt.pin) {
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+            CPU_SET(cpus[proc_index % num_cpus], &set);
+            if (sched_setaffinity(0, sizeof(set), &set) < 0)
+                die("sched_setaffinity");
+        }
+        if (opt.fifo) {
+            struct sched_param sp = { .sched_priority = opt.fifo };
+
+            if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+                die("SCHED_FIFO (needs CAP_SYS_NICE)");
+        }
+        event_loop(subs, count);
+    }
+
+    for (uint32_t i = 0; i < count && !opt.epoll; i++) {
+        struct submitter *s = &subs[i];
+        pthread_attr_t attr;
+
+        pthread_attr_init(&attr);
+        if (s->cpu >= 0) {
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+            CPU_SET(s->cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        attr_set_fifo(&attr);
+
+        int err = pthread_create(&s->thread, &attr,
+                                 opt.gpu_loop ? submitter_loop : submitter_run,
+                                 s);
+        pthread_attr_destroy(&attr);
+        if (err) {
+            errno = err;
+            die(err == EPERM ? "pthread_create (SCHED_FIFO needs CAP_SYS_NICE)"
+                             : "pthread_create");
+        }
+    }
+
+    /*
+     * 5) Per-queue totals, then the aggregate across all queues. Each
+     *    queue is measured from the end of its warm-up to its last
+     *    completion; the aggregate spans all of them.
+     */
+    static struct stats all;
+    uint64_t end = run_start;
+
+    stats_reset(&all, UINT64_MAX);
+    for (uint32_t i = 0; i < count; i++) {
+        if (!opt.epoll)
+            pthread_join(subs[i].thread, NULL);
+        stats_merge(&all, &subs[i].total);
+        if (subs[i].total.start_ns < all.start_ns)
+            all.start_ns = subs[i].total.start_ns;
+        if (subs[i].end_ns > end)
+            end = subs[i].end_ns;
+    }
+    if (opt.util)
+        util_stop();
+
+    if (result_fd >= 0) {
+        static struct proc_result r;
+
+        for (uint32_t i = 0; i < count; i++) {
+            snprintf(r.name, sizeof(r.name), "%s", subs[i].name);
+            r.end_ns = subs[i].end_ns;
+            r.st = subs[i].total;
+            write_full(result_fd, &r, sizeof(r));
+        }
+    } else {
+        for (uint32_t i = 0; i < count; i++)
+            stats_report(&subs[i].total, "total", subs[i].name,
+                         subs[i].end_ns);
+        if (count > 1)
+            stats_report(&all, "total", "all", end);
     }
 
-    /* Not reached, but for completeness */
-    munmap(map, BO_SIZE);
+    /* 6) Release everything in reverse order of creation */
+    for (uint32_t i = 0; i < count; i++)
+        submitter_teardown(&subs[i]);
+    free(subs);
+
+    struct drm_xe_vm_destroy vmd = { .vm_id = vm.id };
+
+    if (ioctl(fd, DRM_IOCTL_XE_VM_DESTROY, &vmd) < 0)
+        die("DRM_IOCTL_XE_VM_DESTROY");
     close(fd);
 
     return 0;
 }
+
+/* Read exactly len bytes; false on EOF before the first one. */
+static bool read_full(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = read(fd, (uint8_t *)buf + done, len - done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            die("read results");
+        if (n == 0) {
+            if (done)
+                fprintf(stderr, "WARNING: truncated result record\n");
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+/*
+ * --procs: fork one independent DRM client per process, each with its own
+ * fd, VM and exec queues, then report every queue, every process and the
+ * sum of all of them.
+ */
+static int run_procs(void)
+{
+    int fds[MAX_PROCS];
+    int status = EXIT_SUCCESS;
+
+    install_stop_handlers();   /* children stop, we collect */
+
+    /* children inherit stdio buffers; do not let them print ours twice */
+    report_csv_header();
+    fflush(stdout);
+    fflush(report_out);
+    run_start = now_ns();
+
+    for (uint32_t i = 0; i < opt.procs; i++) {
+        int p[2];
+
+        if (pipe2(p, O_CLOEXEC) < 0)
+            die("pipe2");
+
+        pid_t pid = fork();
+        if (pid < 0)
+            die("fork");
+        if (pid == 0) {
+            num_child_pids = 0;
+            for (uint32_t j = 0; j < i; j++)
+                close(fds[j]);
+            close(p[0]);
+            proc_index = i;
+            exit(run_client(p[1]));
+        }
+        close(p[1]);
+        fds[i] = p[0];
+        child_pids[i] = pid;
+        num_child_pids = i + 1;
+    }
+
+    static struct stats all, proc;
+    static struct proc_result r;
+    uint64_t end = run_start;
+
+    /* measured from the earliest child start, not from the forks */
+    stats_reset(&all, UINT64_MAX);
+
+    for (uint32_t i = 0; i < opt.procs; i++) {
+        char label[16];
+        uint64_t proc_end = run_start;
+        int wstatus;
+
+        /* the earliest start of any of its queues, as for "all" */
+        stats_reset(&proc, UINT64_MAX);
+        while (read_full(fds[i], &r, sizeof(r))) {
+            stats_report(&r.st, "total", r.name, r.end_ns);
+            stats_merge(&proc, &r.st);
+            if (r.st.start_ns < proc.start_ns)
+                proc.start_ns = r.st.start_ns;
+            if (r.end_ns > proc_end)
+                proc_end = r.end_ns;
+        }
+        close(fds[i]);
+        if (proc.start_ns == UINT64_MAX)
+            proc.start_ns = run_start;
+
+        while (waitpid(child_pids[i], &wstatus, 0) < 0 && errno == EINTR)
+            ;
+        if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus)) {
+            fprintf(stderr, "process %u failed\n", i);
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        snprintf(label, sizeof(label), "p%u", i);
+        stats_report(&proc, "total", label, proc_end);
+        stats_merge(&all, &proc);
+        if (proc.start_ns < all.start_ns)
+            all.start_ns = proc.start_ns;
+        if (proc_end > end)
+            end = proc_end;
+    }
+    if (all.start_ns == UINT64_MAX)
+        all.start_ns = run_start;
+
+    stats_report(&all, "total", "all", end);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    parse_options(argc, argv);
+
+    report_out = stdout;
+    if (opt.output) {
+        report_out = fopen(opt.output, "w");
+        if (!report_out)
+            die(opt.output);
+    }
+
+    ret = opt.procs > 1 ? run_procs() : run_client(-1);
+
+    if (report_out != stdout)
+        fclose(report_out);
+    return ret;
+}
@@ -6,9 +6,29 @@
 #include <linux/cpumask.h>
 #include <linux/smp.h>
 #include <linux/interrupt.h>
+#include <linux/list.h>
+#include <linux/version.h>
+#include <linux/slab.h>
+#include <linux/moduleparam.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <asm/irq_regs.h>
+
+#include "toy_pmu_mmap.h"
+
+/*
+ * Tracepoints sit behind static keys: while disabled each trace_toy_pmu_*()
+ * call is a patched-out jump, so they stay in the hot paths unconditionally.
+ * Enable with: echo 1 > /sys/kernel/tracing/events/toy_pmu/enable
+ */
+#define CREATE_TRACE_POINTS
+#include "toy_pmu_trace.h"
 
 #define DRV_NAME "toy_pmu"
 #define PMU_NAME "toy"
+#define TOY_MAX_PMUS 256
 
 /* config[7:0] encodes the toy event id; we only support 0x1 = ticks */
 #define TOY_EVENT_TICKS 0x1
@@ -17,72 +37,206 @@ struct toy_cpu_ctx {
 	local64_t counter;          /* per-CPU monotonically increasing ticks */
 	struct hrtimer timer;       /* 1ms periodic timer while active > 0 */
 	atomic_t   active;          /* number of active perf events on this CPU */
+	struct list_head events;    /* sampling events scheduled on this CPU */
+	s64        lateness;        /* ns the current expiry ran past its deadline */
+	struct toy_pmu_mmap_slot *slot; /* this ctx's slot in /dev/toy_pmu */
 };
 
-static DEFINE_PER_CPU(struct toy_cpu_ctx, toy_cpu);
-static struct pmu toy_pmu;
+/*
+ * PERF_SAMPLE_RAW payload carried by every toy sample (perf record -R).
+ * Native-endian, packed in this order; toy_pmu_raw.py decodes it from
+ * `perf script -s`.
+ */
+struct toy_raw_sample {
+	u64 counter;                /* toy_cpu_ctx.counter at the overflow */
+	s64 lateness_ns;            /* hrtimer expiry lateness for this tick */
+	u32 active;                 /* active toy events on the sampled CPU */
+	u32 cpu;
+};
+
+/* one registered PMU: its own type, sysfs node and per-CPU state */
+struct toy_pmu_dev {
+	struct pmu pmu;
+	struct toy_cpu_ctx __percpu *cpu;
+	char name[16];
+	bool registered;
+};
+
+static unsigned int num_pmus = 1;
+module_param(num_pmus, uint, 0444);
+MODULE_PARM_DESC(num_pmus,
+		 "Number of toy PMUs to register; >1 names them toy0..toyN-1");
+
+static struct toy_pmu_dev *toy_pmus;
+
+/* vmalloc_user() area behind /dev/toy_pmu: header + one slot per ctx */
+static void *toy_mmap_area;
+static size_t toy_mmap_size;
+
+static inline struct toy_pmu_dev *to_toy_pmu(struct pmu *pmu)
+{
+	return container_of(pmu, struct toy_pmu_dev, pmu);
+}
+
+static void toy_event_overflow(struct toy_cpu_ctx *c, struct perf_event *event);
+static void toy_event_stop(struct perf_event *event, int flags);
 
 /* ---------- per-CPU timer ---------- */
 
+/* Single writer (this CPU's timer), so a bare sequence count suffices. */
+static void toy_slot_publish(struct toy_cpu_ctx *c)
+{
+	struct toy_pmu_mmap_slot *slot = c->slot;
+	u32 seq = slot->seq;
+
+	WRITE_ONCE(slot->seq, seq + 1);
+	smp_wmb();
+	WRITE_ONCE(slot->counter, local64_read(&c->counter));
+	smp_wmb();
+	WRITE_ONCE(slot->seq, seq + 2);
+}
+
 static enum hrtimer_restart toy_hrtimer_cb(struct hrtimer *t)
 {
 	struct toy_cpu_ctx *c = container_of(t, struct toy_cpu_ctx, timer);
+	struct perf_event *event;
 
-	if (atomic_read(&c->active) > 0) {
-		local64_inc(&c->counter);
-		hrtimer_forward_now(&c->timer, ktime_set(0, NSEC_PER_MSEC));
-		return HRTIMER_RESTART;
-	}
-	return HRTIMER_NORESTART;
+	if (atomic_read(&c->active) <= 0)
+		return HRTIMER_NORESTART;
+
+	c->lateness = ktime_to_ns(ktime_sub(hrtimer_cb_get_time(t),
+					    hrtimer_get_expires(t)));
+	local64_inc(&c->counter);
+	toy_slot_publish(c);
+	trace_toy_pmu_tick(local64_read(&c->counter), c->lateness,
+			   atomic_read(&c->active));
+
+	/* may stop (throttle) events, which can drop active to 0 */
+	list_for_each_entry(event, &c->events, active_entry)
+		toy_event_overflow(c, event);
+
+	if (atomic_read(&c->active) <= 0)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(&c->timer, ktime_set(0, NSEC_PER_MSEC));
+	return HRTIMER_RESTART;
 }
 
-static void toy_cpu_start(void)
+static void toy_cpu_start(struct toy_cpu_ctx *c)
 {
-	struct toy_cpu_ctx *c = this_cpu_ptr(&toy_cpu);
-
 	if (atomic_inc_return(&c->active) == 1)
 		hrtimer_start(&c->timer, ktime_set(0, NSEC_PER_MSEC),
 			      HRTIMER_MODE_REL_PINNED);
 }
 
-static void toy_cpu_stop(void)
+static void toy_cpu_stop(struct toy_cpu_ctx *c)
 {
-	struct toy_cpu_ctx *c = this_cpu_ptr(&toy_cpu);
-
+	/*
+	 * Throttling stops events from inside toy_hrtimer_cb(), where
+	 * hrtimer_cancel() would wait on ourselves; the callback sees
+	 * active == 0 and does not restart instead.
+	 */
 	if (atomic_dec_return(&c->active) == 0)
-		hrtimer_cancel(&c->timer);
+		hrtimer_try_to_cancel(&c->timer);
 }
 
 /* ---------- perf PMU plumbing ---------- */
 
-static void toy_event_update(struct perf_event *event)
+static u64 toy_event_update(struct perf_event *event)
 {
-	u64 now;
+	struct toy_pmu_dev *tp = to_toy_pmu(event->pmu);
+	u64 now, delta;
 
 	/* read this CPU's tick counter */
-	now = local64_read(&get_cpu_var(toy_cpu).counter);
-	put_cpu_var(toy_cpu);
+	now = local64_read(&get_cpu_ptr(tp->cpu)->counter);
+	put_cpu_ptr(tp->cpu);
 
 	/* compute delta using hw.prev_count as our previous snapshot */
 	{
 		u64 prev = local64_read(&event->hw.prev_count);
-		u64 delta = now - prev;
 
+		delta = now - prev;
 		local64_set(&event->hw.prev_count, now);
 		local64_add(delta, &event->count);
 	}
+	return delta;
+}
+
+/* Consume delta ticks of the sample period; true when a sample is due. */
+static bool toy_event_period_elapsed(struct perf_event *event, u64 delta)
+{
+	struct hw_perf_event *hwc = &event->hw;
+	s64 left;
+
+	local64_sub(delta, &hwc->period_left);
+	left = local64_read(&hwc->period_left);
+	if (left > 0)
+		return false;
+
+	/* one sample per expiry, even if the timer skipped several periods */
+	do {
+		left += hwc->sample_period;
+	} while (left <= 0);
+	local64_set(&hwc->period_left, left);
+	hwc->last_period = hwc->sample_period;
+	return true;
+}
+
+static void toy_sample_save_raw(struct perf_sample_data *data,
+				struct perf_event *event,
+				struct perf_raw_record *raw)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	perf_sample_save_raw_data(data, event, raw);
+#else
+	perf_sample_save_raw_data(data, raw);
+#endif
+}
+
+/* Called from toy_hrtimer_cb() for every sampling event on this CPU. */
+static void toy_event_overflow(struct toy_cpu_ctx *c, struct perf_event *event)
+{
+	struct toy_raw_sample payload;
+	struct perf_raw_record raw = {
+		.frag = {
+			.size = sizeof(payload),
+			.data = &payload,
+		},
+	};
+	struct perf_sample_data data;
+	struct pt_regs *regs = get_irq_regs();
+
+	if (event->hw.state & PERF_HES_STOPPED)
+		return;
+
+	if (!toy_event_period_elapsed(event, toy_event_update(event)) || !regs)
+		return;
+
+	payload.counter     = local64_read(&c->counter);
+	payload.lateness_ns = c->lateness;
+	payload.active      = atomic_read(&c->active);
+	payload.cpu         = smp_processor_id();
+
+	perf_sample_data_init(&data, 0, event->hw.last_period);
+	if (event->attr.sample_type & PERF_SAMPLE_RAW)
+		toy_sample_save_raw(&data, event, &raw);
+
+	/* throttled: stop is idempotent if the core already stopped us */
+	if (perf_event_overflow(event, &data, regs))
+		toy_event_stop(event, 0);
 }
 
 static int toy_event_init(struct perf_event *event)
 {
 	u64 cfg;
 
-	if (event->attr.type != toy_pmu.type)
+	if (event->attr.type != event->pmu->type)
 		return -ENOENT;
 
-	/* counting only (no sampling) */
-	if (event->attr.sample_period)
-		return -EINVAL;
+	/*
+	 * Sampling is driven by the 1ms tick: sample_period counts ticks and
+	 * the core has already seeded hw.period_left from it.
+	 */
 
 	/* we accept both task and CPU events */
 	cfg = event->attr.config & 0xFFULL;
@@ -95,29 +249,39 @@ static int toy_event_init(struct perf_event *event)
 
 static void toy_event_start(struct perf_event *event, int flags)
 {
-	u64 start = local64_read(&get_cpu_var(toy_cpu).counter);
-	put_cpu_var(toy_cpu);
+	struct toy_pmu_dev *tp = to_toy_pmu(event->pmu);
+	unsigned long irqflags;
+	u64 start = local64_read(&get_cpu_ptr(tp->cpu)->counter);
+	put_cpu_ptr(tp->cpu);
 
 	local64_set(&event->hw.prev_count, start);
 	perf_event_update_userpage(event);
 
 	event->hw.state = 0;
 
-	local_irq_disable();
-	toy_cpu_start();
-	local_irq_enable();
+	local_irq_save(irqflags);
+	toy_cpu_start(this_cpu_ptr(tp->cpu));
+	local_irq_restore(irqflags);
+
+	trace_toy_pmu_start(event, flags);
 }
 
 static void toy_event_stop(struct perf_event *event, int flags)
 {
+	struct toy_pmu_dev *tp = to_toy_pmu(event->pmu);
+	unsigned long irqflags;
+
 	if (!(event->hw.state & PERF_HES_STOPPED)) {
 		toy_event_update(event);
 		event->hw.state |= PERF_HES_STOPPED;
 
-		local_irq_disable();
-		toy_cpu_stop();
-		local_irq_enable();
+		/* save/restore: we can be called from the hrtimer on throttle */
+		local_irq_save(irqflags);
+		toy_cpu_stop(this_cpu_ptr(tp->cpu));
+		local_irq_restore(irqflags);
 	}
+
+	trace_toy_pmu_stop(event, flags);
 }
 
 static int toy_event_add(struct perf_event *event, int flags)
@@ -125,20 +289,32 @@ static int toy_event_add(struct perf_event *event, int flags)
 	local64_set(&event->count, 0);
 	event->hw.state = PERF_HES_STOPPED;
 
+	/* add/del run with IRQs off, so the timer never sees a half-linked entry */
+	if (is_sampling_event(event))
+		list_add_tail(&event->active_entry,
+			      &this_cpu_ptr(to_toy_pmu(event->pmu)->cpu)->events);
+
 	if (flags & PERF_EF_START)
 		toy_event_start(event, flags);
 
+	trace_toy_pmu_add(event, flags);
 	return 0;
 }
 
 static void toy_event_del(struct perf_event *event, int flags)
 {
 	toy_event_stop(event, flags);
+
+	if (is_sampling_event(event))
+		list_del_init(&event->active_entry);
+
+	trace_toy_pmu_del(event, flags);
 }
 
 static void toy_event_read(struct perf_event *event)
 {
 	toy_event_update(event);
+	trace_toy_pmu_read(event, 0);
 }
 
 /* ---------- sysfs: events & format ---------- */
@@ -171,50 +347,180 @@ static const struct attribute_group *toy_attr_groups[] = {
 	NULL,
 };
 
+/* ---------- /dev/toy_pmu: read-only counter mapping ---------- */
+
+static int toy_mmap_alloc(void)
+{
+	struct toy_pmu_mmap_header *hdr;
+
+	toy_mmap_size = PAGE_ALIGN(TOY_PMU_SLOT_SIZE *
+				   (1 + (size_t)num_pmus * nr_cpu_ids));
+	toy_mmap_area = vmalloc_user(toy_mmap_size);
+	if (!toy_mmap_area)
+		return -ENOMEM;
+
+	hdr = toy_mmap_area;
+	hdr->magic        = TOY_PMU_MMAP_MAGIC;
+	hdr->version      = TOY_PMU_MMAP_VERSION;
+	hdr->nr_pmus      = num_pmus;
+	hdr->nr_cpus      = nr_cpu_ids;
+	hdr->slot_size    = TOY_PMU_SLOT_SIZE;
+	hdr->slots_offset = TOY_PMU_SLOT_SIZE;
+	return 0;
+}
+
+static struct toy_pmu_mmap_slot *toy_mmap_slot(unsigned int pmu, int cpu)
+{
+	struct toy_pmu_mmap_slot *slots = toy_mmap_area + TOY_PMU_SLOT_SIZE;
+
+	return &slots[pmu * nr_cpu_ids + cpu];
+}
+
+static int toy_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	/* no mprotect(PROT_WRITE) later either */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+	return remap_vmalloc_range(vma, toy_mmap_area, vma->vm_pgoff);
+}
+
+static const struct file_operations toy_dev_fops = {
+	.owner  = THIS_MODULE,
+	.mmap   = toy_dev_mmap,
+	.llseek = noop_llseek,
+};
+
+static struct miscdevice toy_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name  = DRV_NAME,
+	.fops  = &toy_dev_fops,
+	.mode  = 0444,
+};
+
 /* ---------- module init/exit ---------- */
 
-static int __init toy_pmu_init(void)
+static void toy_pmu_dev_destroy(struct toy_pmu_dev *tp)
 {
 	int cpu;
 
+	if (tp->registered)
+		perf_pmu_unregister(&tp->pmu);
+
+	for_each_possible_cpu(cpu) {
+		struct toy_cpu_ctx *c = per_cpu_ptr(tp->cpu, cpu);
+		hrtimer_cancel(&c->timer);
+	}
+	free_percpu(tp->cpu);
+}
+
+static int toy_pmu_dev_create(struct toy_pmu_dev *tp, unsigned int idx)
+{
+	int cpu, ret;
+
+	tp->cpu = alloc_percpu(struct toy_cpu_ctx);
+	if (!tp->cpu)
+		return -ENOMEM;
+
 	for_each_possible_cpu(cpu) {
-		struct toy_cpu_ctx *c = per_cpu_ptr(&toy_cpu, cpu);
+		struct toy_cpu_ctx *c = per_cpu_ptr(tp->cpu, cpu);
 		local64_set(&c->counter, 0);
 		atomic_set(&c->active, 0);
+		INIT_LIST_HEAD(&c->events);
+		c->lateness = 0;
+		c->slot = toy_mmap_slot(idx, cpu);
 		hrtimer_init(&c->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
 		c->timer.function = toy_hrtimer_cb;
 	}
 
-	memset(&toy_pmu, 0, sizeof(toy_pmu));
-	toy_pmu.module       = THIS_MODULE;
-	toy_pmu.capabilities  = PERF_PMU_CAP_NO_EXCLUDE;
-	toy_pmu.task_ctx_nr   = perf_invalid_context;
-	toy_pmu.attr_groups   = toy_attr_groups;
-	toy_pmu.event_init    = toy_event_init;
-	toy_pmu.add           = toy_event_add;   /* int (*)() */
-	toy_pmu.del           = toy_event_del;
-	toy_pmu.start         = toy_event_start;
-	toy_pmu.stop          = toy_event_stop;
-	toy_pmu.read          = toy_event_read;
-
-	if (perf_pmu_register(&toy_pmu, PMU_NAME, -1)) {
-		pr_err(DRV_NAME ": perf_pmu_register failed\n");
-		return -ENODEV;
+	/* a single instance keeps the historical "toy" name */
+	if (num_pmus == 1)
+		strscpy(tp->name, PMU_NAME, sizeof(tp->name));
+	else
+		snprintf(tp->name, sizeof(tp->name), PMU_NAME "%u", idx);
+
+	tp->pmu.module       = THIS_MODULE;
+	tp->pmu.capabilities  = PERF_PMU_CAP_NO_EXCLUDE;
+	tp->pmu.task_ctx_nr   = perf_invalid_context;
+	tp->pmu.attr_groups   = toy_attr_groups;
+	tp->pmu.event_init    = toy_event_init;
+	tp->pmu.add           = toy_event_add;   /* int (*)() */
+	tp->pmu.del           = toy_event_del;
+	tp->pmu.start         = toy_event_start;
+	tp->pmu.stop          = toy_event_stop;
+	tp->pmu.read          = toy_event_read;
+
+	ret = perf_pmu_register(&tp->pmu, tp->name, -1);
+	if (ret) {
+		pr_err(DRV_NAME ": perf_pmu_register(%s) failed: %d\n",
+		       tp->name, ret);
+		return ret;
 	}
-	pr_info(DRV_NAME ": registered PMU '%s' (type=%d)\n", PMU_NAME, toy_pmu.type);
+	tp->registered = true;
+	pr_info(DRV_NAME ": registered PMU '%s' (type=%d)\n",
+		tp->name, tp->pmu.type);
 	return 0;
 }
 
-static void __exit toy_pmu_exit(void)
+static int __init toy_pmu_init(void)
 {
-	int cpu;
+	unsigned int i;
+	int ret;
+
+	if (!num_pmus || num_pmus > TOY_MAX_PMUS) {
+		pr_err(DRV_NAME ": num_pmus must be 1..%d\n", TOY_MAX_PMUS);
+		return -EINVAL;
+	}
 
-	perf_pmu_unregister(&toy_pmu);
+	ret = toy_mmap_alloc();
+	if (ret)
+		return ret;
 
-	for_each_possible_cpu(cpu) {
-		struct toy_cpu_ctx *c = per_cpu_ptr(&toy_cpu, cpu);
-		hrtimer_cancel(&c->timer);
+	toy_pmus = kcalloc(num_pmus, sizeof(*toy_pmus), GFP_KERNEL);
+	if (!toy_pmus) {
+		vfree(toy_mmap_area);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < num_pmus; i++) {
+		ret = toy_pmu_dev_create(&toy_pmus[i], i);
+		if (ret)
+			goto err_unwind;
 	}
+
+	ret = misc_register(&toy_miscdev);
+	if (ret) {
+		pr_err(DRV_NAME ": misc_register failed: %d\n", ret);
+		i = num_pmus - 1;
+		goto err_unwind;
+	}
+	return 0;
+
+err_unwind:
+	/* the failed instance may hold per-CPU state but is not registered */
+	do {
+		if (toy_pmus[i].cpu)
+			toy_pmu_dev_destroy(&toy_pmus[i]);
+	} while (i-- > 0);
+	kfree(toy_pmus);
+	vfree(toy_mmap_area);
+	return ret;
+}
+
+static void __exit toy_pmu_exit(void)
+{
+	unsigned int i;
+
+	misc_deregister(&toy_miscdev);
+	for (i = 0; i < num_pmus; i++)
+		toy_pmu_dev_destroy(&toy_pmus[i]);
+	kfree(toy_pmus);
+	vfree(toy_mmap_area);
 	pr_info(DRV_NAME ": unregistered\n");
 }
 
@@ -223,4 +529,3 @@ MODULE_DESCRIPTION("Toy PMU exposing toy/ticks/");
 MODULE_LICENSE("GPL");
 module_init(toy_pmu_init);
 module_exit(toy_pmu_exit);
-
@@ -0,0 +1,359 @@
+/*
+ * Counting-accuracy and overhead benchmarks for the toy PMU.
+ *
+ *   cc -O2 -Wall -o toy_pmu_bench toy_pmu_bench.c
+ *   sudo ./toy_pmu_bench [-p toy] [-d seconds] [-n loops] [accuracy|overhead|snapshot|all]
+ *
+ * Results are printed as "<test> key=value ..." lines so the VM harness
+ * (toy_pmu_vm_test.sh) can collect and diff them.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <inttypes.h>
+
+#include <linux/perf_event.h>
+
+#include "toy_pmu_mmap.h"
+
+/* must match TOY_EVENT_TICKS in toy_pmu.c */
+#define TOY_EVENT_TICKS 0x1
+#define TOY_TICK_NS     1000000ull
+
+static void die(const char *msg)
+{
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* PMU type as assigned by perf_pmu_register(), from sysfs. */
+static int read_pmu_type(const char *pmu)
+{
+    char path[256];
+    int type = -1;
+
+    snprintf(path, sizeof(path),
+             "/sys/bus/event_source/devices/%s/type", pmu);
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s (module loaded?)\n",
+                path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (fscanf(f, "%d", &type) != 1)
+        type = -1;
+    fclose(f);
+
+    if (type < 0) {
+        fprintf(stderr, "Bad PMU type in %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return type;
+}
+
+/* toy events are CPU-scoped only (perf_invalid_context). */
+static int open_toy_event(int type, int cpu)
+{
+    struct perf_event_attr attr = {
+        .type     = type,
+        .size     = sizeof(attr),
+        .config   = TOY_EVENT_TICKS,
+        .disabled = 1,
+    };
+
+    int fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1, 0);
+    if (fd < 0)
+        die("perf_event_open");
+    return fd;
+}
+
+static uint64_t read_count(int fd)
+{
+    uint64_t v;
+
+    if (read(fd, &v, sizeof(v)) != sizeof(v))
+        die("read counter");
+    return v;
+}
+
+static void pin_to_cpu(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        die("sched_setaffinity");
+}
+
+/*
+ * The CPUs we may run on, in ascending order. Online CPU numbers need not
+ * be contiguous, so walk the affinity mask rather than 0..ncpu-1.
+ */
+static int *allowed_cpus(int *count)
+{
+    cpu_set_t set;
+    int n = 0;
+
+    if (sched_getaffinity(0, sizeof(set), &set) < 0)
+        die("sched_getaffinity");
+
+    int *cpus = calloc(CPU_COUNT(&set), sizeof(*cpus));
+    if (!cpus)
+        die("calloc cpus");
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &set))
+            cpus[n++] = cpu;
+
+    *count = n;
+    return cpus;
+}
+
+/*
+ * Count for a fixed wall-clock window on every allowed CPU and compare the
+ * ticks seen against elapsed time at one tick per millisecond.
+ */
+static void bench_accuracy(int type, unsigned int seconds)
+{
+    int ncpu;
+    int *cpus = allowed_cpus(&ncpu);
+    int *fds = calloc(ncpu, sizeof(*fds));
+    if (!fds)
+        die("calloc fds");
+
+    for (int i = 0; i < ncpu; i++)
+        fds[i] = open_toy_event(type, cpus[i]);
+
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < ncpu; i++)
+        ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+
+    sleep(seconds);
+
+    for (int i = 0; i < ncpu; i++)
+        ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t elapsed = now_ns() - t0;
+
+    double expected = (double)elapsed / TOY_TICK_NS;
+    double worst = 0.0;
+
+    for (int i = 0; i < ncpu; i++) {
+        uint64_t ticks = read_count(fds[i]);
+        double err = (ticks - expected) * 100.0 / expected;
+
+        printf("accuracy cpu=%d ticks=%" PRIu64 " expected=%.1f error_pct=%.3f\n",
+               cpus[i], ticks, expected, err);
+        if (err < 0 ? -err > worst : err > worst)
+            worst = err < 0 ? -err : err;
+        close(fds[i]);
+    }
+    printf("accuracy cpus=%d seconds=%u worst_error_pct=%.3f\n",
+           ncpu, seconds, worst);
+    free(fds);
+    free(cpus);
+}
+
+static uint64_t spin_loop(uint64_t loops)
+{
+    volatile uint64_t sink = 0;
+    uint64_t t0 = now_ns();
+
+    for (uint64_t i = 0; i < loops; i++)
+        sink += i;
+    return now_ns() - t0;
+}
+
+/*
+ * Cost the toy PMU adds to a CPU-bound loop on its CPU (timer interrupts),
+ * plus the syscall cost of reading the counter.
+ */
+static void bench_overhead(int type, uint64_t loops)
+{
+    const int reads = 100000;
+    int ncpu;
+    int *cpus = allowed_cpus(&ncpu);
+    int cpu = cpus[0];    /* CPU 0 may be outside our cpuset */
+
+    free(cpus);
+    pin_to_cpu(cpu);
+
+    spin_loop(loops / 10);  /* warm up */
+    uint64_t base = spin_loop(loops);
+
+    int fd = open_toy_event(type, cpu);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    uint64_t counted = spin_loop(loops);
+
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < reads; i++)
+        read_count(fd);
+    uint64_t read_ns = now_ns() - t0;
+
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    close(fd);
+
+    printf("overhead cpu=%d loops=%" PRIu64 " base_ns=%" PRIu64
+           " counted_ns=%" PRIu64 " overhead_pct=%.3f read_ns=%.1f\n",
+           cpu, loops, base, counted,
+           ((double)counted - base) * 100.0 / base,
+           (double)read_ns / reads);
+}
+
+/* Seqcount read of one /dev/toy_pmu slot; see toy_pmu_mmap.h. */
+static uint64_t read_slot(const struct toy_pmu_mmap_slot *slot)
+{
+    uint32_t seq;
+    uint64_t val;
+
+    do {
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        val = __atomic_load_n(&slot->counter, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&slot->seq, __ATOMIC_RELAXED));
+
+    return val;
+}
+
+/*
+ * Snapshot every (pmu, cpu) counter through the /dev/toy_pmu mapping and
+ * time it against the per-CPU perf read() path it replaces.
+ */
+static void bench_snapshot(int type)
+{
+    const int rounds = 10000;
+
+    int dfd = open("/dev/toy_pmu", O_RDONLY | O_CLOEXEC);
+    if (dfd < 0)
+        die("open /dev/toy_pmu");
+
+    const struct toy_pmu_mmap_header *hdr =
+        mmap(NULL, TOY_PMU_SLOT_SIZE, PROT_READ, MAP_SHARED, dfd, 0);
+    if (hdr == MAP_FAILED)
+        die("mmap /dev/toy_pmu header");
+
+    if (hdr->magic != TOY_PMU_MMAP_MAGIC ||
+        hdr->version != TOY_PMU_MMAP_VERSION) {
+        fprintf(stderr, "Unexpected /dev/toy_pmu layout (magic=0x%x version=%u)\n",
+                hdr->magic, hdr->version);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t nr_pmus = hdr->nr_pmus, nr_cpus = hdr->nr_cpus;
+    size_t size = hdr->slots_offset +
+                  (size_t)hdr->slot_size * nr_pmus * nr_cpus;
+    munmap((void *)hdr, TOY_PMU_SLOT_SIZE);
+
+    const uint8_t *map = mmap(NULL, size, PROT_READ, MAP_SHARED, dfd, 0);
+    if (map == MAP_FAILED)
+        die("mmap /dev/toy_pmu");
+    close(dfd);
+
+    hdr = (const void *)map;
+    const struct toy_pmu_mmap_slot *slots =
+        (const void *)(map + hdr->slots_offset);
+    uint64_t *snap = calloc((size_t)nr_pmus * nr_cpus, sizeof(*snap));
+    if (!snap)
+        die("calloc snapshot");
+
+    /* keep the timers running on every CPU while we look */
+    int ncpu;
+    int *cpus = allowed_cpus(&ncpu);
+    int *fds = calloc(ncpu, sizeof(*fds));
+    if (!fds)
+        die("calloc fds");
+    for (int i = 0; i < ncpu; i++) {
+        fds[i] = open_toy_event(type, cpus[i]);
+        ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+    usleep(100000);
+
+    uint64_t t0 = now_ns();
+    for (int r = 0; r < rounds; r++)
+        for (size_t i = 0; i < (size_t)nr_pmus * nr_cpus; i++)
+            snap[i] = read_slot(&slots[i]);
+    uint64_t mmap_ns = now_ns() - t0;
+
+    t0 = now_ns();
+    for (int r = 0; r < rounds; r++)
+        for (int i = 0; i < ncpu; i++)
+            read_count(fds[i]);
+    uint64_t read_ns = now_ns() - t0;
+
+    for (uint32_t p = 0; p < nr_pmus; p++)
+        for (int i = 0; i < ncpu; i++)
+            if ((uint32_t)cpus[i] < nr_cpus)
+                printf("snapshot pmu=%u cpu=%d counter=%" PRIu64 "\n",
+                       p, cpus[i], snap[(size_t)p * nr_cpus + cpus[i]]);
+    printf("snapshot pmus=%u slots=%u mmap_ns=%.1f perf_read_ns=%.1f\n",
+           nr_pmus, nr_pmus * nr_cpus,
+           (double)mmap_ns / rounds, (double)read_ns / rounds);
+
+    for (int i = 0; i < ncpu; i++)
+        close(fds[i]);
+    free(fds);
+    free(cpus);
+    free(snap);
+    munmap((void *)map, size);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [-p pmu] [-d seconds] [-n loops] [accuracy|overhead|snapshot|all]\n",
+            argv0);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    const char *pmu = "toy";
+    unsigned int seconds = 5;
+    uint64_t loops = 500000000ull;
+    int c;
+
+    while ((c = getopt(argc, argv, "p:d:n:h")) != -1) {
+        switch (c) {
+        case 'p': pmu = optarg; break;
+        case 'd': seconds = strtoul(optarg, NULL, 0); break;
+        case 'n': loops = strtoull(optarg, NULL, 0); break;
+        default:  usage(argv[0]);
+        }
+    }
+
+    const char *test = optind < argc ? argv[optind] : "all";
+    bool all = !strcmp(test, "all");
+    int type = read_pmu_type(pmu);
+
+    if (!all && strcmp(test, "accuracy") && strcmp(test, "overhead") &&
+        strcmp(test, "snapshot"))
+        usage(argv[0]);
+
+    if (all || !strcmp(test, "accuracy"))
+        bench_accuracy(type, seconds);
+    if (all || !strcmp(test, "overhead"))
+        bench_overhead(type, loops);
+    if (all || !strcmp(test, "snapshot"))
+        bench_snapshot(type);
+
+    return 0;
+}
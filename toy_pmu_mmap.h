@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Layout of the read-only /dev/toy_pmu mapping. Shared between the module
+ * and userspace readers (toy_pmu_bench snapshot).
+ *
+ * The mapping starts with a header occupying one slot, followed by
+ * nr_pmus * nr_cpus slots indexed [pmu * nr_cpus + cpu]. Slots of CPUs
+ * that are not possible stay zero.
+ */
+#ifndef _TOY_PMU_MMAP_H
+#define _TOY_PMU_MMAP_H
+
+#include <linux/types.h>
+
+#define TOY_PMU_MMAP_MAGIC    0x544f5950   /* "TOYP" */
+#define TOY_PMU_MMAP_VERSION  1
+#define TOY_PMU_SLOT_SIZE     64           /* one cacheline per slot */
+
+struct toy_pmu_mmap_header {
+	__u32 magic;
+	__u32 version;
+	__u32 nr_pmus;
+	__u32 nr_cpus;       /* nr_cpu_ids: slots per PMU */
+	__u32 slot_size;
+	__u32 slots_offset;  /* byte offset of the first slot */
+};
+
+/*
+ * Written only by the owning CPU's toy timer. seq is odd while an update
+ * is in flight; a reader retries until it sees the same even seq on both
+ * sides of its counter load:
+ *
+ *	do {
+ *		seq = load_acquire(&slot->seq);
+ *		val = slot->counter;
+ *		smp_rmb();
+ *	} while ((seq & 1) || seq != slot->seq);
+ */
+struct toy_pmu_mmap_slot {
+	__u32 seq;
+	__u32 pad;
+	__u64 counter;
+	__u8  reserved[TOY_PMU_SLOT_SIZE - 16];
+};
+
+#endif /* _TOY_PMU_MMAP_H */
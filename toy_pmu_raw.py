@@ -0,0 +1,30 @@
+# SPDX-License-Identifier: GPL-2.0
+#
+# Decode the PERF_SAMPLE_RAW payload attached to toy PMU samples.
+#
+#   sudo perf record -e toy/ticks/ -c 10 -R -a -- sleep 1
+#   perf script -s toy_pmu_raw.py
+#
+# Layout mirrors struct toy_raw_sample in toy_pmu.c:
+#   u64 counter, s64 lateness_ns, u32 active, u32 cpu (native endian)
+
+import struct
+
+TOY_RAW = struct.Struct("=QqII")
+
+def trace_begin():
+    print("%-5s %-18s %16s %12s %6s" %
+          ("cpu", "time", "counter", "lateness_ns", "active"))
+
+def process_event(param_dict):
+    raw = param_dict.get("raw_buf")
+    if raw is None or len(raw) < TOY_RAW.size:
+        return
+
+    counter, lateness, active, cpu = TOY_RAW.unpack_from(raw)
+    sample = param_dict["sample"]
+    secs = sample["time"] // 1000000000
+    nsecs = sample["time"] % 1000000000
+
+    print("%-5d %8d.%09d %16d %12d %6d" %
+          (cpu, secs, nsecs, counter, lateness, active))
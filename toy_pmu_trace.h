@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM toy_pmu
+
+#if !defined(_TOY_PMU_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TOY_PMU_TRACE_H
+
+#include <linux/perf_event.h>
+#include <linux/tracepoint.h>
+
+/* add/del/start/stop/read: state and count after the callback ran */
+DECLARE_EVENT_CLASS(toy_pmu_event,
+	TP_PROTO(struct perf_event *event, int flags),
+	TP_ARGS(event, flags),
+
+	TP_STRUCT__entry(
+		__field(u64, id)
+		__field(u64, count)
+		__field(u64, prev_count)
+		__field(int, flags)
+		__field(int, state)
+	),
+
+	TP_fast_assign(
+		__entry->id         = event->id;
+		__entry->count      = local64_read(&event->count);
+		__entry->prev_count = local64_read(&event->hw.prev_count);
+		__entry->flags      = flags;
+		__entry->state      = event->hw.state;
+	),
+
+	TP_printk("id=%llu flags=0x%x state=0x%x count=%llu prev=%llu",
+		  __entry->id, __entry->flags, __entry->state,
+		  __entry->count, __entry->prev_count)
+);
+
+DEFINE_EVENT(toy_pmu_event, toy_pmu_add,
+	TP_PROTO(struct perf_event *event, int flags),
+	TP_ARGS(event, flags));
+
+DEFINE_EVENT(toy_pmu_event, toy_pmu_del,
+	TP_PROTO(struct perf_event *event, int flags),
+	TP_ARGS(event, flags));
+
+DEFINE_EVENT(toy_pmu_event, toy_pmu_start,
+	TP_PROTO(struct perf_event *event, int flags),
+	TP_ARGS(event, flags));
+
+DEFINE_EVENT(toy_pmu_event, toy_pmu_stop,
+	TP_PROTO(struct perf_event *event, int flags),
+	TP_ARGS(event, flags));
+
+DEFINE_EVENT(toy_pmu_event, toy_pmu_read,
+	TP_PROTO(struct perf_event *event, int flags),
+	TP_ARGS(event, flags));
+
+/* one entry per toy_hrtimer_cb() expiry that found active events */
+TRACE_EVENT(toy_pmu_tick,
+	TP_PROTO(u64 counter, s64 lateness, int active),
+	TP_ARGS(counter, lateness, active),
+
+	TP_STRUCT__entry(
+		__field(u64, counter)
+		__field(s64, lateness)
+		__field(int, active)
+	),
+
+	TP_fast_assign(
+		__entry->counter  = counter;
+		__entry->lateness = lateness;
+		__entry->active   = active;
+	),
+
+	TP_printk("counter=%llu lateness_ns=%lld active=%d",
+		  __entry->counter, __entry->lateness, __entry->active)
+);
+
+#endif /* _TOY_PMU_TRACE_H */
+
+/* out-of-tree: the Makefile adds -I$(src) so define_trace.h finds us */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE toy_pmu_trace
+#include <trace/define_trace.h>
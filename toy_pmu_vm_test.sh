@@ -0,0 +1,68 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0
+#
+# Boot a kernel tree in a virtme-ng (QEMU) guest, load toy_pmu.ko and run
+# toy_pmu_bench, collecting results under $RESULTS/<timestamp>/.
+# Normally driven by `make vm-test KDIR=/path/to/linux`.
+#
+# Environment:
+#   KDIR      built kernel tree the module was compiled against
+#   VNG       virtme-ng launcher (default: vng)
+#   RESULTS   results directory (default: results)
+#   CPUS      guest vCPUs (default: 4)
+#   NUM_PMUS  toy_pmu num_pmus= parameter (default: 1)
+#   DURATION  accuracy window in seconds (default: 5)
+#
+# Inside the guest the script re-runs itself with --guest <outdir>.
+
+set -eu
+
+here=$(cd "$(dirname "$0")" && pwd)
+NUM_PMUS=${NUM_PMUS:-1}
+DURATION=${DURATION:-5}
+
+if [ "${1:-}" = "--guest" ]; then
+	out=$2
+	cd "$here"
+
+	if [ "$NUM_PMUS" -gt 1 ]; then pmu=toy0; else pmu=toy; fi
+
+	uname -a > "$out/kernel.txt"
+	insmod ./toy_pmu.ko num_pmus="$NUM_PMUS"
+	ls /sys/bus/event_source/devices > "$out/pmus.txt"
+
+	./toy_pmu_bench -p "$pmu" -d "$DURATION" accuracy | tee "$out/accuracy.txt"
+	./toy_pmu_bench -p "$pmu" overhead | tee "$out/overhead.txt"
+	./toy_pmu_bench -p "$pmu" snapshot | tee "$out/snapshot.txt"
+
+	rmmod toy_pmu
+	dmesg | grep toy_pmu > "$out/dmesg.txt" || true
+	exit 0
+fi
+
+KDIR=${KDIR:-/lib/modules/$(uname -r)/build}
+VNG=${VNG:-vng}
+RESULTS=${RESULTS:-results}
+CPUS=${CPUS:-4}
+
+if ! command -v "$VNG" >/dev/null 2>&1; then
+	echo "$VNG not found; install virtme-ng (pip install virtme-ng)" >&2
+	exit 1
+fi
+for f in toy_pmu.ko toy_pmu_bench; do
+	if [ ! -e "$here/$f" ]; then
+		echo "$here/$f missing; run make vm-test" >&2
+		exit 1
+	fi
+done
+
+out=$(mkdir -p "$RESULTS" && cd "$RESULTS" && pwd)/$(date +%Y%m%d-%H%M%S)
+mkdir -p "$out"
+
+echo "Booting $KDIR with $CPUS vCPUs, results in $out"
+"$VNG" --run "$KDIR" --user root --cpus "$CPUS" --rwdir "$out" \
+	--exec "NUM_PMUS=$NUM_PMUS DURATION=$DURATION $here/toy_pmu_vm_test.sh --guest $out"
+
+grep -h worst_error_pct "$out/accuracy.txt"
+cat "$out/overhead.txt"
+grep -h "^snapshot pmus=" "$out/snapshot.txt"